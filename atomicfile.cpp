@@ -0,0 +1,30 @@
+#include "atomicfile.hpp"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#else
+#include <windows.h>
+#endif
+
+bool atomic_replace(const std::string &tmp_path, const std::string &path) {
+#ifndef _WIN32
+  // data must reach disk before rename makes it the file
+  int fd = ::open(tmp_path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  bool synced = fsync(fd) == 0;
+  ::close(fd);
+  if(!synced)
+    return false;
+
+  // rename replaces target atomically
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+#else
+  // write through makes move wait for data and metadata to reach disk
+  return MoveFileExA(tmp_path.c_str(), path.c_str(),
+    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#endif
+}
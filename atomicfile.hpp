@@ -0,0 +1,11 @@
+#ifndef _ATOMICFILE_HPP
+#define _ATOMICFILE_HPP
+
+#include <string>
+
+// flush file written at tmp_path to disk then move it over path in a single
+// step, after a crash path holds either its previous or its new content.
+// Return false and leave path untouched on failure.
+bool atomic_replace(const std::string &tmp_path, const std::string &path);
+
+#endif//_ATOMICFILE_HPP
@@ -0,0 +1,408 @@
+#include "audioanalyzer.hpp"
+#include "loudnessmeter.hpp"
+#include "atomicfile.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+const uint32_t ANALYSIS_CACHE_MAGIC = 0x4b504253; // "SBPK"
+const uint32_t ANALYSIS_CACHE_VERSION = 3;
+
+// packed analysis summary, stored in sessions
+typedef struct {
+  uint32_t version;
+  int32_t samplerate_hz;
+  uint64_t frames;
+  uint64_t start_frame;
+  uint64_t end_frame;
+  float loudness_lufs;
+  float true_peak_dbtp;
+} analysis_summary_t;
+
+constexpr float AudioAnalysis::SILENCE_THRESHOLD;
+constexpr float AudioAnalysis::TRUE_PEAK_CEILING_DBTP;
+
+// widen [lo, hi] to include n floats, lanes are independent so the loop
+// compiles to packed min/max instructions
+static void minmax(const float *x, size_t n, float &lo, float &hi) {
+  const size_t LANES = 8;
+  float l[LANES], h[LANES];
+  for(size_t j=0; j<LANES; j++) {
+    l[j] = lo;
+    h[j] = hi;
+  }
+
+  size_t i = 0;
+  for(; i + LANES <= n; i += LANES) {
+    for(size_t j=0; j<LANES; j++) {
+      l[j] = x[i+j] < l[j] ? x[i+j] : l[j];
+      h[j] = x[i+j] > h[j] ? x[i+j] : h[j];
+    }
+  }
+  for(; i<n; i++) {
+    lo = std::min(lo, x[i]);
+    hi = std::max(hi, x[i]);
+  }
+
+  for(size_t j=0; j<LANES; j++) {
+    lo = std::min(lo, l[j]);
+    hi = std::max(hi, h[j]);
+  }
+}
+
+// index of first of n floats above threshold in magnitude, n if none. Whole
+// blocks of lanes are tested at once, only the block holding the first
+// audible sample is scanned sample by sample.
+static size_t find_first_audible(const float *x, size_t n, float threshold) {
+  const size_t LANES = 8;
+  size_t i = 0;
+  for(; i + LANES <= n; i += LANES) {
+    int audible = 0;
+    for(size_t j=0; j<LANES; j++)
+      audible |= std::fabs(x[i+j]) > threshold;
+    if(audible)
+      break;
+  }
+  for(; i<n; i++) {
+    if(std::fabs(x[i]) > threshold)
+      return i;
+  }
+  return n;
+}
+
+// index of last of n floats above threshold in magnitude, n if none
+static size_t find_last_audible(const float *x, size_t n, float threshold) {
+  const size_t LANES = 8;
+  size_t i = n;
+  for(; i >= LANES; i -= LANES) {
+    int audible = 0;
+    for(size_t j=0; j<LANES; j++)
+      audible |= std::fabs(x[i-LANES+j]) > threshold;
+    if(audible)
+      break;
+  }
+  for(; i>0; i--) {
+    if(std::fabs(x[i-1]) > threshold)
+      return i-1;
+  }
+  return n;
+}
+
+static int16_t quantize_peak(float v) {
+  return std::lrint(std::min(1.0f, std::max(-1.0f, v))*32767);
+}
+
+AudioAnalysis::AudioAnalysis()
+  :frames(0),
+  samplerate_hz(0),
+  start_frame(0),
+  end_frame(0),
+  loudness_lufs(-INFINITY),
+  true_peak_dbtp(-INFINITY),
+  failed(false) {
+}
+
+float AudioAnalysis::get_normalization_gain(float target_lufs) const {
+  if(!std::isfinite(loudness_lufs))
+    return 1.0;
+
+  float gain_db = target_lufs - loudness_lufs;
+  if(std::isfinite(true_peak_dbtp))
+    gain_db = std::min(gain_db, TRUE_PEAK_CEILING_DBTP - true_peak_dbtp);
+  return std::pow(10.0f, gain_db/20);
+}
+
+void AudioAnalysis::get_peak(uint64_t from, uint64_t to, float &min, float &max) const {
+  min = max = 0.0;
+  if(peaks.empty() || to <= from)
+    return;
+
+  // coarsest level still finer than requested range
+  size_t k = 0;
+  while(k + 1 < peaks.size() && ((uint64_t)PEAK_BLOCK << (k + 1)) <= to - from)
+    k++;
+
+  auto const& level = peaks[k];
+  uint64_t block = (uint64_t)PEAK_BLOCK << k;
+  uint64_t a = from/block;
+  uint64_t b = std::min<uint64_t>(level.size(), (to + block - 1)/block);
+  if(a >= b)
+    return;
+
+  int16_t lo = level[a].min, hi = level[a].max;
+  for(auto i=a+1; i<b; i++) {
+    lo = std::min(lo, level[i].min);
+    hi = std::max(hi, level[i].max);
+  }
+  min = lo/32767.0;
+  max = hi/32767.0;
+}
+
+bool AudioAnalysis::load(const std::string &path) {
+  std::ifstream ifile(path, std::ios::binary);
+  if(!ifile)
+    return false;
+
+  uint32_t magic, version, nlevels;
+  int32_t samplerate;
+  uint64_t nframes, start, end;
+  float loudness, true_peak;
+  ifile.read((char*)&magic, sizeof(magic));
+  ifile.read((char*)&version, sizeof(version));
+  ifile.read((char*)&nframes, sizeof(nframes));
+  ifile.read((char*)&samplerate, sizeof(samplerate));
+  ifile.read((char*)&start, sizeof(start));
+  ifile.read((char*)&end, sizeof(end));
+  ifile.read((char*)&loudness, sizeof(loudness));
+  ifile.read((char*)&true_peak, sizeof(true_peak));
+  ifile.read((char*)&nlevels, sizeof(nlevels));
+  if(!ifile || magic != ANALYSIS_CACHE_MAGIC || version != ANALYSIS_CACHE_VERSION
+    || nlevels > 64 || start > end || end > nframes)
+    return false;
+
+  std::vector<std::vector<audio_peak_t>> _peaks(nlevels);
+  for(auto& level: _peaks) {
+    uint64_t count;
+    ifile.read((char*)&count, sizeof(count));
+    if(!ifile || count > nframes/PEAK_BLOCK + 1)
+      return false;
+    level.resize(count);
+    ifile.read((char*)level.data(), count*sizeof(audio_peak_t));
+  }
+  if(!ifile)
+    return false;
+
+  frames = nframes;
+  samplerate_hz = samplerate;
+  start_frame = start;
+  end_frame = end;
+  loudness_lufs = loudness;
+  true_peak_dbtp = true_peak;
+  peaks = std::move(_peaks);
+  return true;
+}
+
+bool AudioAnalysis::save(const std::string &path) const {
+  // write aside and rename so a reader never sees a partial file
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream ofile(tmp_path, std::ios::binary | std::ios::trunc);
+    if(!ofile)
+      return false;
+
+    uint32_t magic = ANALYSIS_CACHE_MAGIC, version = ANALYSIS_CACHE_VERSION;
+    uint32_t nlevels = peaks.size();
+    int32_t samplerate = samplerate_hz;
+    uint64_t nframes = frames, start = start_frame, end = end_frame;
+    float loudness = loudness_lufs, true_peak = true_peak_dbtp;
+    ofile.write((const char*)&magic, sizeof(magic));
+    ofile.write((const char*)&version, sizeof(version));
+    ofile.write((const char*)&nframes, sizeof(nframes));
+    ofile.write((const char*)&samplerate, sizeof(samplerate));
+    ofile.write((const char*)&start, sizeof(start));
+    ofile.write((const char*)&end, sizeof(end));
+    ofile.write((const char*)&loudness, sizeof(loudness));
+    ofile.write((const char*)&true_peak, sizeof(true_peak));
+    ofile.write((const char*)&nlevels, sizeof(nlevels));
+    for(auto const& level: peaks) {
+      uint64_t count = level.size();
+      ofile.write((const char*)&count, sizeof(count));
+      ofile.write((const char*)level.data(), count*sizeof(audio_peak_t));
+    }
+    if(!ofile)
+      return false;
+  }
+
+  return atomic_replace(tmp_path, path);
+}
+
+std::string AudioAnalysis::save_summary(void) const {
+  analysis_summary_t summary = {ANALYSIS_CACHE_VERSION, samplerate_hz,
+    frames, start_frame, end_frame, loudness_lufs, true_peak_dbtp};
+  return std::string((const char*)&summary, sizeof(summary));
+}
+
+bool AudioAnalysis::load_summary(const std::string &data) {
+  analysis_summary_t summary;
+  if(data.size() != sizeof(summary))
+    return false;
+  memcpy(&summary, data.data(), sizeof(summary));
+  if(summary.version != ANALYSIS_CACHE_VERSION
+    || summary.start_frame > summary.end_frame || summary.end_frame > summary.frames)
+    return false;
+
+  frames = summary.frames;
+  samplerate_hz = summary.samplerate_hz;
+  start_frame = summary.start_frame;
+  end_frame = summary.end_frame;
+  loudness_lufs = summary.loudness_lufs;
+  true_peak_dbtp = summary.true_peak_dbtp;
+  peaks.clear();
+  return true;
+}
+
+AudioAnalyzer::AudioAnalyzer(const std::string &cache_directory, unsigned nthreads)
+  :cache_directory(cache_directory),
+  pool(nthreads) {
+}
+
+AudioAnalyzer::~AudioAnalyzer() {
+}
+
+std::shared_ptr<const AudioAnalysis> AudioAnalyzer::get(const std::string &filename) {
+  std::unique_lock<std::mutex> mlock(results_mutex);
+
+  auto it = results.find(filename);
+  if(it != results.end())
+    return it->second;
+
+  if(scheduled.insert(filename).second)
+    pool.push([this, filename]() { analyze(filename); });
+
+  return nullptr;
+}
+
+void AudioAnalyzer::analyze(const std::string &filename) {
+  auto analysis = std::make_shared<AudioAnalysis>();
+
+  auto path = get_cache_path(filename);
+  if(path.empty() || !analysis->load(path)) {
+    // failure is kept as a result so file is not decoded over and over
+    if(!decode(filename, *analysis)) {
+      analysis = std::make_shared<AudioAnalysis>();
+      analysis->failed = true;
+      if(!pool.is_quitting())
+        std::cerr<<"could not analyze "<<filename<<"\n";
+    }
+    else if(!path.empty() && !analysis->save(path))
+      std::cerr<<"could not write analysis cache "<<path<<"\n";
+  }
+
+  std::unique_lock<std::mutex> mlock(results_mutex);
+  results[filename] = analysis;
+}
+
+bool AudioAnalyzer::decode(const std::string &filename, AudioAnalysis &analysis) {
+  auto decoder = Decoder::create(filename);
+  if(!decoder)
+    return false;
+  decoder->set_auto_rewind(false);
+  if(!decoder->open(filename))
+    return false;
+  decoder->start();
+
+  LoudnessMeter meter(decoder->get_parameters().samplerate_hz);
+
+  const unsigned CHUNK_FRAMES = 16*AudioAnalysis::PEAK_BLOCK;
+
+  // first pyramid level, straight from decoded frames
+  std::vector<audio_peak_t> level;
+  std::vector<float> left(CHUNK_FRAMES), right(CHUNK_FRAMES);
+  // frames not summarized yet, one array per channel
+  std::vector<float> pending_left, pending_right;
+  uint64_t frames = 0;
+  bool audible = false;
+  bool eof = false;
+  while(!eof) {
+    if(pool.is_quitting()) {
+      decoder->exit();
+      decoder->join();
+      return false;
+    }
+
+    size_t n = decoder->pop_frames(left.data(), right.data(), CHUNK_FRAMES);
+    eof = n == 0;
+
+    meter.process(left.data(), right.data(), n);
+
+    // bounds of audible frames, over both channels
+    if(!eof) {
+      const float threshold = AudioAnalysis::SILENCE_THRESHOLD;
+      if(!audible) {
+        size_t first = std::min(find_first_audible(left.data(), n, threshold),
+          find_first_audible(right.data(), n, threshold));
+        if(first < n) {
+          analysis.start_frame = frames + first;
+          audible = true;
+        }
+      }
+      size_t last_left = find_last_audible(left.data(), n, threshold);
+      size_t last_right = find_last_audible(right.data(), n, threshold);
+      // n means none
+      size_t last = last_left == n ? last_right
+        : last_right == n ? last_left : std::max(last_left, last_right);
+      if(last < n)
+        analysis.end_frame = frames + last + 1;
+    }
+    pending_left.insert(pending_left.end(), left.begin(), left.begin() + n);
+    pending_right.insert(pending_right.end(), right.begin(), right.begin() + n);
+    frames += n;
+
+    // summarize complete blocks, and the last partial one at end of file
+    size_t i = 0;
+    const size_t npending = pending_left.size();
+    while(npending - i >= AudioAnalysis::PEAK_BLOCK
+      || (eof && i < npending)) {
+      size_t m = std::min<size_t>(AudioAnalysis::PEAK_BLOCK, npending - i);
+      float lo = pending_left[i], hi = pending_left[i];
+      minmax(&pending_left[i], m, lo, hi);
+      minmax(&pending_right[i], m, lo, hi);
+      level.push_back({quantize_peak(lo), quantize_peak(hi)});
+      i += m;
+    }
+    pending_left.erase(pending_left.begin(), pending_left.begin() + i);
+    pending_right.erase(pending_right.begin(), pending_right.begin() + i);
+  }
+
+  decoder->exit();
+  decoder->join();
+
+  analysis.frames = frames;
+  analysis.samplerate_hz = decoder->get_parameters().samplerate_hz;
+  analysis.loudness_lufs = meter.get_integrated_loudness();
+  analysis.true_peak_dbtp = 20*std::log10(meter.get_true_peak());
+
+  // each level halves the previous one, down to a single peak
+  analysis.peaks.clear();
+  analysis.peaks.push_back(std::move(level));
+  while(analysis.peaks.back().size() > 1) {
+    auto const& fine = analysis.peaks.back();
+    std::vector<audio_peak_t> coarse((fine.size() + 1)/2);
+    for(size_t k=0; k<coarse.size(); k++) {
+      auto const& a = fine[2*k];
+      auto const& b = (2*k + 1 < fine.size()) ? fine[2*k + 1] : a;
+      coarse[k] = {std::min(a.min, b.min), std::max(a.max, b.max)};
+    }
+    analysis.peaks.push_back(std::move(coarse));
+  }
+
+  return true;
+}
+
+std::string AudioAnalyzer::get_cache_key(const std::string &filename) {
+  struct stat st;
+  if(stat(filename.c_str(), &st) != 0)
+    return "";
+
+  std::ostringstream key;
+  key<<filename<<"#"<<st.st_size<<"#"<<st.st_mtime;
+  return key.str();
+}
+
+std::string AudioAnalyzer::get_cache_path(const std::string &filename) {
+  auto key = get_cache_key(filename);
+  if(key.empty())
+    return "";
+
+  std::ostringstream path;
+  path<<cache_directory<<"/"<<std::hex<<std::hash<std::string>()(key)<<".analysis";
+  return path.str();
+}
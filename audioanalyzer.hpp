@@ -0,0 +1,110 @@
+#ifndef _AUDIOANALYZER_HPP
+#define _AUDIOANALYZER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "decoder.hpp"
+#include "threadpool.hpp"
+
+// quantized min/max of a run of frames, both channels merged
+typedef struct {
+  int16_t min;
+  int16_t max;
+} audio_peak_t;
+
+// results of a whole file analysis, immutable once published
+class AudioAnalysis {
+
+  public:
+    AudioAnalysis();
+
+    // frames summarized by each peak of first pyramid level
+    static const unsigned PEAK_BLOCK = 256;
+
+    // samples below this magnitude (-60 dBFS) are silent
+    static constexpr float SILENCE_THRESHOLD = 0.001;
+
+    // normalized files never peak above this level
+    static constexpr float TRUE_PEAK_CEILING_DBTP = -1.0;
+
+    // linear gain bringing file to target integrated loudness, lowered if
+    // needed to keep its true peak under ceiling, 1 for silent files
+    float get_normalization_gain(float target_lufs) const;
+
+    // min/max of frames [from, to), in [-1, 1]
+    void get_peak(uint64_t from, uint64_t to, float &min, float &max) const;
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    // everything but peaks, packed to be kept with session so trimming and
+    // normalization apply before analyzer is done with file
+    std::string save_summary(void) const;
+    bool load_summary(const std::string &data);
+
+    // decoded frames in file
+    uint64_t frames;
+    int samplerate_hz;
+
+    // first audible frame and frame following last audible one, both 0 when
+    // whole file is silent
+    uint64_t start_frame;
+    uint64_t end_frame;
+
+    // EBU R128 integrated loudness (-infinity when silent) and true peak
+    float loudness_lufs;
+    float true_peak_dbtp;
+
+    // min/max pyramid, peaks of level k summarize PEAK_BLOCK<<k frames
+    std::vector<std::vector<audio_peak_t>> peaks;
+
+    // file could not be decoded, nothing else is set
+    bool failed;
+};
+
+// analyze files on a pool of background threads, results are cached on disk
+// so a file is only decoded once as long as it is not modified
+class AudioAnalyzer {
+
+  public:
+    // 0 threads means one per hardware thread
+    AudioAnalyzer(const std::string &cache_directory, unsigned nthreads = 0);
+    ~AudioAnalyzer();
+
+    // return analysis of file if available, failed one if file could not
+    // be decoded, schedule it and return null otherwise, never blocks
+    std::shared_ptr<const AudioAnalysis> get(const std::string &filename);
+
+    // identify file contents, changes whenever file is replaced or
+    // modified, empty if file does not exist
+    std::string get_cache_key(const std::string &filename);
+
+  private:
+
+    // run from a pool thread
+    void analyze(const std::string &filename);
+
+    // decode whole file, return false on error or when pool is quitting
+    bool decode(const std::string &filename, AudioAnalysis &analysis);
+
+    // cache file of an audio file, changes whenever the audio file does
+    std::string get_cache_path(const std::string &filename);
+
+    std::string cache_directory;
+
+    std::map<std::string, std::shared_ptr<const AudioAnalysis>> results;
+    // files queued or being analyzed
+    std::set<std::string> scheduled;
+    std::mutex results_mutex;
+
+    // declared last so workers are joined before anything else is destroyed
+    ThreadPool pool;
+};
+
+#endif//_AUDIOANALYZER_HPP
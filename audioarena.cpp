@@ -0,0 +1,232 @@
+#include "audioarena.hpp"
+
+#include <iostream>
+#include <new>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+const size_t AudioArena::MIN_BLOCK;
+const unsigned AudioArena::SMALL_CLASSES;
+const size_t AudioArena::LARGE_BLOCK;
+const size_t AudioArena::PAGE;
+
+// transparent huge pages are used when region is aligned on them
+static const size_t HUGE_PAGE = 2*1024*1024;
+
+AudioArena &AudioArena::get(void) {
+  static AudioArena arena;
+  return arena;
+}
+
+AudioArena::AudioArena()
+  :region(NULL),
+  region_size(0),
+  top(0),
+  large_blocks(NULL),
+  locked(0),
+  used(0),
+  overflows(0) {
+
+  for(auto& b: small_blocks)
+    b = NULL;
+}
+
+AudioArena::~AudioArena() {
+  // region is left mapped, blocks may still be released by other static
+  // objects destroyed after this one
+}
+
+bool AudioArena::reserve(size_t bytes, bool huge_pages) {
+  std::unique_lock<std::mutex> mlock(mutex);
+  if(region || bytes == 0)
+    return region != NULL;
+
+#ifndef _WIN32
+  bytes = (bytes + PAGE - 1)/PAGE*PAGE;
+
+  // map more than asked for so region can start on a huge page
+  size_t mapped = huge_pages ? bytes + HUGE_PAGE : bytes;
+  void *p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) {
+    lock_error = strerror(errno);
+    std::cerr<<"audio arena mmap error "<<lock_error<<"\n";
+    return false;
+  }
+  unsigned char *start = static_cast<unsigned char*>(p);
+  if(huge_pages) {
+    start += (HUGE_PAGE - (uintptr_t)start % HUGE_PAGE) % HUGE_PAGE;
+#ifdef MADV_HUGEPAGE
+    madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+  }
+
+  // touch every page so none is missing when audio thread gets to it
+  for(size_t i=0; i<bytes; i+=PAGE)
+    start[i] = 0;
+
+  if(::mlock(start, bytes) == 0) {
+    locked = bytes;
+  }
+  else {
+    lock_error = strerror(errno);
+    std::cerr<<"audio arena mlock error "<<lock_error<<"\n";
+  }
+
+  region = start;
+  region_size = bytes;
+  return true;
+#else
+  (void)huge_pages;
+  lock_error = "not supported";
+  return false;
+#endif
+}
+
+size_t AudioArena::get_block_size(size_t bytes) {
+  if(bytes <= LARGE_BLOCK/2) {
+    size_t size = MIN_BLOCK;
+    while(size < bytes)
+      size <<= 1;
+    return size;
+  }
+  return (bytes + PAGE - 1)/PAGE*PAGE;
+}
+
+bool AudioArena::contains(void *p) {
+  auto b = static_cast<unsigned char*>(p);
+  return region && b >= region && b < region + region_size;
+}
+
+void *AudioArena::allocate(size_t bytes) {
+  size_t size = get_block_size(bytes);
+  {
+    std::unique_lock<std::mutex> mlock(mutex);
+    void *p = NULL;
+
+    if(size <= LARGE_BLOCK/2) {
+      // recycle block of same size
+      unsigned c = 0;
+      while((MIN_BLOCK << c) < size)
+        c++;
+      if(small_blocks[c]) {
+        p = small_blocks[c];
+        small_blocks[c] = small_blocks[c]->next;
+      }
+    }
+    else {
+      // first fit, what is left of block stays free in its place. Large
+      // sizes are whole pages so the rest is always a whole block.
+      for(free_block_t **b = &large_blocks; *b; b = &(*b)->next) {
+        if((*b)->size < size)
+          continue;
+        free_block_t *block = *b;
+        if(block->size > size) {
+          auto rest = reinterpret_cast<free_block_t*>((unsigned char*)block + size);
+          rest->next = block->next;
+          rest->size = block->size - size;
+          *b = rest;
+        }
+        else {
+          *b = block->next;
+        }
+        p = block;
+        break;
+      }
+    }
+
+    // carve new block from region
+    if(!p && region && region_size - top >= size) {
+      p = region + top;
+      top += size;
+    }
+
+    if(p) {
+      used += size;
+      return p;
+    }
+  }
+
+  overflows++;
+  return ::operator new(bytes);
+}
+
+void AudioArena::deallocate(void *p, size_t bytes) {
+  if(!p)
+    return;
+  if(!contains(p)) {
+    ::operator delete(p);
+    return;
+  }
+
+  size_t size = get_block_size(bytes);
+  std::unique_lock<std::mutex> mlock(mutex);
+  used -= size;
+
+  auto block = static_cast<free_block_t*>(p);
+  block->size = size;
+  if(size <= LARGE_BLOCK/2) {
+    unsigned c = 0;
+    while((MIN_BLOCK << c) < size)
+      c++;
+    block->next = small_blocks[c];
+    small_blocks[c] = block;
+  }
+  else {
+    // list is kept in address order so neighbours merge back together
+    free_block_t **link = &large_blocks;
+    free_block_t **prev_link = NULL;
+    while(*link && *link < block) {
+      prev_link = link;
+      link = &(*link)->next;
+    }
+    block->next = *link;
+    *link = block;
+
+    auto end = [](free_block_t *f) {
+      return reinterpret_cast<unsigned char*>(f) + f->size;
+    };
+    if(block->next && end(block) == reinterpret_cast<unsigned char*>(block->next)) {
+      block->size += block->next->size;
+      block->next = block->next->next;
+    }
+    if(prev_link && end(*prev_link) == reinterpret_cast<unsigned char*>(block)) {
+      (*prev_link)->size += block->size;
+      (*prev_link)->next = block->next;
+      link = prev_link;
+      block = *link;
+    }
+
+    // last block carved from region goes back to it
+    if(end(block) == region + top) {
+      top -= block->size;
+      *link = block->next;
+    }
+  }
+}
+
+size_t AudioArena::get_reserved_bytes(void) {
+  std::unique_lock<std::mutex> mlock(mutex);
+  return region_size;
+}
+
+size_t AudioArena::get_locked_bytes(void) {
+  return locked;
+}
+
+size_t AudioArena::get_used_bytes(void) {
+  return used;
+}
+
+size_t AudioArena::get_overflows(void) {
+  return overflows;
+}
+
+std::string AudioArena::get_lock_error(void) {
+  std::unique_lock<std::mutex> mlock(mutex);
+  return lock_error;
+}
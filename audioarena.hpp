@@ -0,0 +1,112 @@
+#ifndef _AUDIOARENA_HPP
+#define _AUDIOARENA_HPP
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// memory seen by the audio thread: players, scratch and ring buffers,
+// cached samples. It is taken from a single region mapped once, prefaulted
+// and locked in RAM, so the audio callback never page faults on it. Blocks
+// are recycled by size, allocations not fitting in region fall back to heap.
+class AudioArena {
+
+  public:
+    static AudioArena &get(void);
+
+    // map, prefault and lock region of given size, backed by transparent
+    // huge pages if asked to. Only first call has effect, allocations made
+    // before come from heap. Return false if region could not be mapped.
+    bool reserve(size_t bytes, bool huge_pages);
+
+    void *allocate(size_t bytes);
+    void deallocate(void *p, size_t bytes);
+
+    size_t get_reserved_bytes(void);
+    size_t get_locked_bytes(void);
+    size_t get_used_bytes(void);
+    // allocations that did not fit in region
+    size_t get_overflows(void);
+    // reason region could not be locked, empty if it was
+    std::string get_lock_error(void);
+
+  private:
+    AudioArena();
+    ~AudioArena();
+
+    AudioArena(const AudioArena&) = delete;
+    AudioArena& operator=(const AudioArena&) = delete;
+
+    // smallest block, blocks are aligned on it
+    static const size_t MIN_BLOCK = 64;
+    // small blocks are rounded to a power of two and recycled by size,
+    // larger ones are rounded to a page, recycled first fit and merged with
+    // free neighbours once released
+    static const unsigned SMALL_CLASSES = 15;
+    static const size_t LARGE_BLOCK = MIN_BLOCK << SMALL_CLASSES;
+    static const size_t PAGE = 4096;
+
+    // size actually taken from region for an allocation
+    static size_t get_block_size(size_t bytes);
+
+    bool contains(void *p);
+
+    // free block, stored in the block itself
+    typedef struct free_block {
+      struct free_block *next;
+      size_t size;
+    } free_block_t;
+
+    unsigned char *region;
+    size_t region_size;
+    // region bytes handed out at least once
+    size_t top;
+    free_block_t *small_blocks[SMALL_CLASSES];
+    free_block_t *large_blocks;
+    std::mutex mutex;
+
+    std::atomic<size_t> locked;
+    std::atomic<size_t> used;
+    std::atomic<size_t> overflows;
+    std::string lock_error;
+};
+
+// standard allocator drawing from audio arena
+template<typename T>
+class ArenaAllocator {
+
+  public:
+    typedef T value_type;
+
+    ArenaAllocator() {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) {
+    }
+
+    T *allocate(size_t n) {
+      return static_cast<T*>(AudioArena::get().allocate(n*sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+      AudioArena::get().deallocate(p, n*sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+  return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+  return false;
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif//_AUDIOARENA_HPP
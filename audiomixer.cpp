@@ -3,29 +3,93 @@
 #include <algorithm>
 #include <thread>
 #include <cmath>
+#include <set>
+#include <map>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+static PaSampleFormat get_portaudio_format(OutputFormat format) {
+  switch(format) {
+    case OUTPUT_FORMAT_INT32: return paInt32;
+    case OUTPUT_FORMAT_INT24: return paInt24;
+    case OUTPUT_FORMAT_INT16: return paInt16;
+    default: return paFloat32;
+  }
+}
 
-
-AudioPlayer::AudioPlayer(AudioMixer *mixer)
+constexpr float AudioPlayer::GAIN_SMOOTHING_SECONDS;
+constexpr float AudioPlayer::DEFAULT_FADE_OUT_SECONDS;
+const unsigned long AudioPlayer::MIX_BLOCK_FRAMES;
+const unsigned AudioPlayer::MAX_RESAMPLE_RATIO;
+constexpr float AudioMixer::CHOKE_FADE_SECONDS;
+constexpr float AudioMixer::BUS_FADE_SECONDS;
+constexpr double AudioMixer::HANDOVER_TIMEOUT_SECONDS;
+constexpr double AudioMixer::OUTPUT_STALL_SECONDS;
+constexpr double AudioMixer::CALIBRATION_SECONDS;
+constexpr double AudioMixer::CALIBRATION_SETTLE_SECONDS;
+const unsigned AudioMixer::CALIBRATION_VOICES;
+constexpr double AudioMixer::CALIBRATION_DEADLINE;
+const unsigned long AudioMixer::MAX_BUFFER_FRAMES;
+
+AudioPlayer::AudioPlayer(AudioMixer *mixer, AudioPlayerID id)
   :mixer(mixer),
-  stream(NULL),
+  id(id),
+  next_decoder(nullptr),
+  resampler_position(0.0),
+  fade_release(false),
+  start_offset(0),
+  restart_pending(false),
+  restart_fade(0.0),
+  fade_in(0.0),
+  fade_out(DEFAULT_FADE_OUT_SECONDS),
+  fade_shape(GAIN_RAMP_LINEAR),
   gain(1.0),
+  normalization(1.0),
   repeat(false),
   mute(false),
-  level(0.0) {
+  level(0.0),
+  position(0),
+  range_start(0),
+  range_end(0),
+  pending(false),
+  pending_frame(0),
+  active(false),
+  in_voices(false),
+  removed(false),
+  xpos(-1),
+  ypos(-1),
+  seen_loops(0),
+  seen_errors(0),
+  seen_underruns(0) {
+
+  // audio callback never grows scratch buffers, a block resampled at
+  // highest ratio plus frames surrounding its last position fit in them
+  resampler_left.reserve(MIX_BLOCK_FRAMES*MAX_RESAMPLE_RATIO + 4);
+  resampler_right.reserve(MIX_BLOCK_FRAMES*MAX_RESAMPLE_RATIO + 4);
+  mix_left.reserve(MIX_BLOCK_FRAMES);
+  mix_right.reserve(MIX_BLOCK_FRAMES);
+  mix_gains.reserve(MIX_BLOCK_FRAMES);
+  mix_fades.reserve(MIX_BLOCK_FRAMES);
 }
 
 AudioPlayer::~AudioPlayer() {
-
+  // player is no voice anymore, audio callback is done with its decoders
+  unprepare();
 }
 
 bool AudioPlayer::close(void) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
 
   if(is_stream_valid()) {
-    auto err = Pa_CloseStream(stream);
-    if(err != paNoError) {
-      std::cerr<<"ErrorA"<<Pa_GetErrorText(err)<<"\n";
-      return false;
-    }
+    // mixer fades voice out and retires its decoder
+    pending = false;
+    stop();
+    unprepare();
     // invalidate
     filename = std::string();
     return true;
@@ -35,17 +99,8 @@ bool AudioPlayer::close(void) {
 }
 
 bool AudioPlayer::play(void) {
-  // check if stream is running
-  if(is_playing()) {
-    return true;
-  }
   if(is_stream_valid()) {
-    auto err = Pa_StartStream(stream);
-    if(err != paNoError) {
-      std::cerr<<"ErrorB"<<Pa_GetErrorText(err)<<"\n";
-      return false;
-    }
-    return true;
+    return mixer->trigger(id);
   }
 
   return false;
@@ -53,7 +108,7 @@ bool AudioPlayer::play(void) {
 
 bool AudioPlayer::is_playing(void) {
   if(is_stream_valid())
-    return Pa_IsStreamActive(stream);
+    return pending || active;
   else
     return false;
 }
@@ -63,26 +118,108 @@ bool AudioPlayer::stop(void) {
   if(!is_playing()) {
     return true;
   }
-  if(is_stream_valid()) {
-    auto err = Pa_StopStream(stream);
-    if(err != paNoError) {
-      std::cerr<<"ErrorC"<<Pa_GetErrorText(err)<<"\n";
-      return false;
-    }
-    set_level(0.0);
-    return true;
-  }
+  // mixer will release voice when fade out is over
+  AudioMixerCommands batch;
+  mixer->collect_stop(id, -1, batch);
+  return mixer->post(batch);
+}
 
-  return false;
+void AudioPlayer::fade(float target, float seconds, bool release, unsigned long offset) {
+  fade_ramp.start(target, seconds*mixer->get_samplerate(), get_fade_shape(), offset);
+  fade_release = release;
+}
+
+void AudioPlayer::start_voice(float fade_seconds, unsigned long offset) {
+  if(fade_seconds < 0)
+    fade_seconds = get_fade_in();
+
+  // start at user gain, fading in from silence if asked to
+  gain_ramp.reset(get_target_gain());
+  fade_ramp.reset(fade_seconds > 0 ? 0.0 : 1.0);
+  fade_ramp.start(1.0, fade_seconds*mixer->get_samplerate(), get_fade_shape());
+  fade_release = false;
+  start_offset = offset;
+  restart_pending = false;
 }
 
 bool AudioPlayer::reset(void) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+
   // stop stream
   stop();
 
-  // kill decoder and build a new one
-  open(filename);
+  // build a new decoder, playing one is left to mixer
+  return prepare();
+}
+
+void AudioPlayer::arm(void) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+
+  // a voice triggered since caller looked at player state is left alone
+  if(pending || is_playing())
+    return;
+
+  if(!is_armed() && is_stream_valid())
+    prepare();
+}
+
+std::unique_ptr<Decoder> AudioPlayer::create_decoder(const std::string &_filename) {
+  // fire up decoder, file cached in memory is not read again
+  std::unique_ptr<Decoder> _decoder;
+  auto cache = mixer->get_sample_cache();
+  auto samples = cache ? cache->get(_filename) : nullptr;
+  if(samples)
+    _decoder = std::make_unique<CachedDecoder>(samples);
+  else
+    _decoder = Decoder::create(_filename);
+  if(!_decoder)
+    return nullptr;
+
+  _decoder->set_auto_rewind(repeat);
+  _decoder->set_range(range_start, range_end);
+
+  // open audio file
+  if(!_decoder->open(_filename))
+    return nullptr;
+  // start decoding
+  _decoder->start();
+  return _decoder;
+}
+
+bool AudioPlayer::prepare(void) {
+  auto _decoder = create_decoder(filename);
+  if(!_decoder)
+    return false;
+
+  // decoder replaced before mixer took it was never played
+  delete next_decoder.exchange(_decoder.release());
+  return true;
+}
+
+void AudioPlayer::unprepare(void) {
+  delete next_decoder.exchange(nullptr);
+}
+
+bool AudioPlayer::is_armed(void) {
+  return next_decoder != nullptr;
+}
 
+bool AudioPlayer::swap_decoder(void) {
+  // current decoder must be retired first, it is kept when queue is full
+  if(decoder && mixer->retired.is_full())
+    return false;
+  Decoder *_decoder = next_decoder.exchange(nullptr);
+  if(!_decoder)
+    return false;
+  if(decoder)
+    mixer->retire_decoder(this);
+
+  decoder.reset(_decoder);
+  resampler_left.clear();
+  resampler_right.clear();
+  resampler_position = 0.0;
+  position = 0;
+  seen_loops = seen_errors = seen_underruns = 0;
   return true;
 }
 
@@ -95,11 +232,68 @@ float AudioPlayer::get_gain(void) {
   return gain;
 }
 
+void AudioPlayer::set_normalization(float v) {
+  normalization = std::max(0.0f, v);
+}
+
+float AudioPlayer::get_normalization(void) {
+  return normalization;
+}
+
+float AudioPlayer::get_target_gain(void) {
+  return get_mute() ? 0.0 : get_normalization()*get_gain();
+}
+
 void AudioPlayer::set_repeat(bool b) {
-  repeat = b;
-  if(is_stream_valid()) {
-    decoder->set_auto_rewind(repeat);
-  }
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+
+  // decoder waiting to be started may have reached end of file already,
+  // voice decoder follows on next buffer
+  if(repeat.exchange(b) != b)
+    unprepare();
+}
+
+void AudioPlayer::set_range(uint64_t start, uint64_t end) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+
+  if(start == range_start && end == range_end)
+    return;
+  range_start = start;
+  range_end = end;
+  // decoder has to be reopened to seek to new range
+  unprepare();
+}
+
+uint64_t AudioPlayer::get_range_start(void) {
+  return range_start;
+}
+
+uint64_t AudioPlayer::get_range_end(void) {
+  return range_end;
+}
+
+void AudioPlayer::set_fade_in(float seconds) {
+  fade_in = std::max(0.0f, seconds);
+}
+
+float AudioPlayer::get_fade_in(void) {
+  return fade_in;
+}
+
+void AudioPlayer::set_fade_out(float seconds) {
+  fade_out = std::max(0.0f, seconds);
+}
+
+float AudioPlayer::get_fade_out(void) {
+  return fade_out;
+}
+
+void AudioPlayer::set_fade_shape(GainRampShape shape) {
+  fade_shape = shape;
+}
+
+GainRampShape AudioPlayer::get_fade_shape(void) {
+  return fade_shape;
 }
 
 void AudioPlayer::set_mute(bool b) {
@@ -110,148 +304,221 @@ bool AudioPlayer::get_mute() {
   return mute;
 }
 
-bool AudioPlayer::open(std::string _filename) {
-  // close current stream if any
-  if(is_stream_valid()) {
-    close();
-  }
+void AudioPlayer::set_trigger_group(const std::string &group) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+  trigger_group = group;
+}
 
-  // store filename
-  filename = _filename;
+std::string AudioPlayer::get_trigger_group(void) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+  return trigger_group;
+}
 
-  // extract extension from filename
-  auto ext = filename.substr( filename.find_last_of(".") +  1);
+void AudioPlayer::set_choke_group(const std::string &group) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+  choke_group = group;
+}
 
-  // fire up decoder (kill existing if any)
-  if(ext == "mp3")
-    decoder = std::make_unique<MADDecoder>();
-  else if(ext == "wav")
-    decoder = std::make_unique<WAVDecoder>();
-  else
-    return false;
+std::string AudioPlayer::get_choke_group(void) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+  return choke_group;
+}
 
-  decoder->set_auto_rewind(repeat);
+void AudioPlayer::set_position(int x, int y) {
+  xpos = x;
+  ypos = y;
+}
 
-  // open audio file
-  if(!decoder->open(filename)) {
-    filename = std::string();
-    return false;
+bool AudioPlayer::is_at_position(int x, int y) {
+  return xpos == x && ypos == y;
+}
+
+bool AudioPlayer::open(std::string _filename) {
+  std::unique_lock<std::recursive_mutex> control_lock(control_mutex);
+
+  // close current decoder if any
+  if(is_stream_valid()) {
+    close();
   }
-  // start decoding
-  decoder->start();
- 
-  // get decoded audio parameters
-  auto p = decoder->get_parameters();
-  // set up PA parameters
-  PaDeviceIndex idx = mixer->get_device();
-  PaStreamParameters op;
-  op.device = idx;
-  op.channelCount = 2;
-  op.sampleFormat = paFloat32;
-  op.suggestedLatency = 0.1;
-  op.hostApiSpecificStreamInfo = NULL;
-  // start PA stream
-  auto err = Pa_OpenStream(
-    &stream,
-    NULL, /*inputParameters*/
-    &op,
-    p.samplerate_hz,
-    paFramesPerBufferUnspecified,
-    0, /*flags*/
-    AudioPlayer::portaudio_feed_callback,
-    (void*)this);
 
-  if(err != paNoError) {
-    std::cerr<<"ErrorE"<<Pa_GetErrorText(err)<<"\n";
+  auto _decoder = create_decoder(_filename);
+  if(!_decoder)
     return false;
-  }
+
+  // store filename, decoder is handed over to mixer once started
+  filename = _filename;
+  delete next_decoder.exchange(_decoder.release());
 
   return true;
 }
 
-int AudioPlayer::portaudio_feed_callback(
-			const void *input_buffer,
-			void *output_buffer,
-			unsigned long frames_per_buffer,
-			const PaStreamCallbackTimeInfo *time_info,
-			PaStreamCallbackFlags status_flags,
-			void *data) {
-  (void)status_flags;
-  (void)time_info;
-  (void)input_buffer;
+bool AudioPlayer::mix(float *left, float *right, unsigned long n) {
+  if(!decoder)
+    return false;
 
-  AudioPlayer *player = static_cast<AudioPlayer*>(data);
+  // decoder keeps enough frames ahead for a few buffers of this size
+  const double ratio = decoder->get_parameters().samplerate_hz / mixer->get_samplerate();
+  decoder->set_block_frames(std::ceil(n*ratio));
 
+  // scratch buffers hold one block, longer buffers are mixed by blocks
+  float peak = 0.0;
+  bool playing = true;
+  for(unsigned long i=0; i<n && playing; i+=MIX_BLOCK_FRAMES)
+    playing = mix_block(left + i, right + i, std::min(MIX_BLOCK_FRAMES, n - i), peak);
 
-  // get frame from decoder (will potentially block)
-  auto frames = player->decoder->pop_frames(frames_per_buffer);
-  if(frames.size() == 0) {
-    // we reached end of file
-    return paComplete;
-  }
+  // update mean signal level
+  set_level(peak);
+  return playing;
+}
 
-  // copy to buffer
-  float *out = (float*)output_buffer;
-  auto gain = player->get_gain();
-  if(player->get_mute()) {
-    gain = 0.0;
-  }
+bool AudioPlayer::mix_block(float *left, float *right, unsigned long n, float &peak) {
+  // whole block, voice may restart within it
+  float *const block_left = left;
+  float *const block_right = right;
+  const unsigned long block_frames = n;
 
-  // measure L/R max signal enveloppe
-  float lmax=0.0,rmax=0.0;
+  decoder->set_auto_rewind(repeat);
 
-  int i = 0;
-  for(auto frame: frames) {
-    i++;
-    float l = gain*frame.left;
-    float r = gain*frame.right;
+  // voice starting later in this buffer
+  if(start_offset > 0) {
+    auto offset = std::min(start_offset, n);
+    left += offset;
+    right += offset;
+    n -= offset;
+    start_offset -= offset;
+  }
 
-    float fl = fabs(l), fr = fabs(r);
-    if(fl > lmax)
-      lmax = fl;
-    if(fr > rmax)
-      rmax = fr;
+  const double samplerate = mixer->get_samplerate();
+
+  // step in decoded frames for each output frame
+  const double ratio = decoder->get_parameters().samplerate_hz / samplerate;
+
+  // make sure decoded frames surround every position of this block
+  bool eof = false;
+  bool starved = false;
+  const double last = resampler_position + (n > 0 ? (n - 1)*ratio : 0.0);
+  if(n > 0 && last + 1.0 >= resampler_left.size()) {
+    // get frames decoded already, never waiting for decoder. Files beyond
+    // highest resampling ratio get what fits and play slowed down by gaps.
+    size_t have = resampler_left.size();
+    size_t room = resampler_left.capacity() - have;
+    unsigned want = std::ceil(last + 2.0 - have);
+    bool clipped = want > room;
+    want = std::min<size_t>(want, room);
+    resampler_left.resize(have + want);
+    resampler_right.resize(have + want);
+    unsigned got = decoder->try_pop_frames(resampler_left.data() + have,
+      resampler_right.data() + have, want, eof);
+    resampler_left.resize(have + got);
+    resampler_right.resize(have + got);
+    starved = (got < want || clipped) && !eof;
+  }
 
-    switch(player->get_mixer_mode()) {
+  // frames left at end of file may not fill whole block, when decoder fell
+  // behind rest of block stays silent and voice resumes from there
+  const size_t available = resampler_left.size();
+  unsigned long m = n;
+  if(eof) {
+    double remaining = (available - resampler_position)/ratio;
+    m = remaining > 0 ? std::min<unsigned long>(n, std::ceil(remaining)) : 0;
+  }
+  else if(starved) {
+    // interpolation needs the frame following each position
+    double remaining = (available - 1.0 - resampler_position)/ratio;
+    m = remaining > 0 ? std::min<unsigned long>(n, std::ceil(remaining)) : 0;
+  }
 
-      case MIXER_MODE_FULL_RIGHT: {
-        *(out++) = 0;
-        *(out++) = (l + r)/2;
-        break;
-      }
+  // resample decoded frames to mixer rate, linear interpolation between
+  // surrounding frames, one channel at a time
+  mix_left.resize(n);
+  mix_right.resize(n);
+  auto resample = [&](const float *in, float *out) {
+    for(unsigned long i=0; i<m; i++) {
+      double p = resampler_position + i*ratio;
+      size_t k = p;
+      size_t a = std::min(k, available - 1);
+      size_t b = std::min(k + 1, available - 1);
+      float t = p - k;
+      out[i] = in[a] + t*(in[b] - in[a]);
+    }
+  };
+  resample(resampler_left.data(), mix_left.data());
+  resample(resampler_right.data(), mix_right.data());
+  resampler_position += m*ratio;
+
+  // drop consumed frames
+  size_t consumed = std::min((size_t)resampler_position, available);
+  resampler_left.erase(resampler_left.begin(), resampler_left.begin() + consumed);
+  resampler_right.erase(resampler_right.begin(), resampler_right.begin() + consumed);
+  resampler_position -= consumed;
+  position += consumed;
+
+  // smooth user gain changes
+  float target = get_target_gain();
+  if(target != gain_ramp.get_target()) {
+    gain_ramp.start(target, GAIN_SMOOTHING_SECONDS*samplerate, GAIN_RAMP_LINEAR);
+  }
 
-      case MIXER_MODE_FULL_LEFT: {
-        *(out++) = (l + r)/2;
-        *(out++) = 0;
-        break;
-      }
+  // voice is released on the exact frame its fade out ends
+  bool released = false;
+  if(fade_release && fade_ramp.get_remaining() <= m) {
+    m = fade_ramp.get_remaining();
+    released = true;
+  }
 
-      case MIXER_MODE_STEREO:
-      default: {
-        *(out++) = l;
-        *(out++) = r;
-        break;
-      }
+  mix_gains.resize(n);
+  mix_fades.resize(n);
+  gain_ramp.render(mix_gains.data(), m);
+  fade_ramp.render(mix_fades.data(), m);
+
+  // combine envelopes once for both channels
+  float *gains = mix_gains.data();
+  const float *fades = mix_fades.data();
+  for(unsigned long i=0; i<m; i++)
+    gains[i] *= fades[i];
+
+  // apply envelope and mix each channel, measuring its max signal envelope
+  auto accumulate = [&](const float *in, float *out) {
+    float peak = 0.0;
+    for(unsigned long i=0; i<m; i++) {
+      float v = gains[i]*in[i];
+      out[i] += v;
+      peak = std::max(peak, std::fabs(v));
+    }
+    return peak;
+  };
+  float lmax = accumulate(mix_left.data(), left);
+  float rmax = accumulate(mix_right.data(), right);
+  peak = std::max(peak, (lmax + rmax)/2);
+
+  // report what decoder went through since last block
+  auto report = [this](unsigned count, unsigned &seen, AudioMixerEventType type) {
+    if(count != seen) {
+      seen = count;
+      mixer->post_event(type, id);
     }
+  };
+  report(decoder->get_loops(), seen_loops, MIXER_EVENT_LOOPED);
+  report(decoder->get_errors(), seen_errors, MIXER_EVENT_DECODE_ERROR);
+  report(decoder->get_underruns(), seen_underruns, MIXER_EVENT_UNDERRUN);
+
+  // voice faded out to be restarted, new decoder starts on following frame
+  bool finished = released || (m < n && !starved);
+  if(finished && restart_pending) {
+    unsigned long offset = (left - block_left) + m;
+    if(!swap_decoder())
+      return false;
+    start_voice(restart_fade, offset);
+    return mix_block(block_left, block_right, block_frames, peak);
   }
 
-  // update mean signal level
-  player->set_level((lmax + rmax)/2);
-
-  return paContinue;
+  return !finished;
 }
 
 bool AudioPlayer::is_stream_valid(void) {
   return !filename.empty();
 }
 
-AudioMixerMode AudioPlayer::get_mixer_mode(void) {
-  if(mixer)
-    return mixer->get_mode();
-  else
-    return MIXER_MODE_STEREO;
-}
-
 void AudioPlayer::set_level(float v) {
   level = v;
 }
@@ -260,15 +527,197 @@ float AudioPlayer::get_level(void) {
   return level;
 }
 
+uint64_t AudioPlayer::get_position(void) {
+  return position;
+}
+
 //
 
-AudioMixer::AudioMixer() {
-  next_audio_player_id = 0;
+AudioMixer::AudioMixer()
+  :owner(0),
+  handover(false),
+  samplerate_hz(44100.0),
+  clock(0),
+  dac_sequence(0),
+  dac_frame(0),
+  dac_time(0.0),
+  buffer_frames(0),
+  current_device(paNoDevice),
+  events_posted(false),
+  events_pending(false),
+  event_quit(false),
+  output_format(OUTPUT_FORMAT_AUTO),
+  output_buffer_frames(0),
+  scan_requested(false),
+  open_requested(false),
+  calibrate_requested(false),
+  calibrating(false),
+  calibration_voices(0),
+  devices_ready(false),
+  portaudio_initialized(false),
+  watched_callbacks(0),
+  device_quit(false) {
+  scheduled.reserve(MAX_SCHEDULED_COMMANDS);
+  voices.reserve(MAX_VOICES);
+  trigger_latency = {0, 0.0, 0.0, 0.0, 0.0};
+
+  for(auto& s: streams) {
+    s.mixer = this;
+    s.stream = NULL;
+    s.samplerate_hz = samplerate_hz;
+    s.output_latency = 0.0;
+    s.handing_over = false;
+    s.fade_in = false;
+    s.format = OUTPUT_FORMAT_AUTO;
+    s.frames_per_buffer = 0;
+    s.callbacks = 0;
+    s.xruns = 0;
+    s.late_callbacks = 0;
+  }
 
-  auto err = Pa_Initialize();
-  if(err != paNoError)
-    std::cerr<<"ErrorF"<<Pa_GetErrorText(err)<<"\n";
+  // PortAudio initialization probes every device and may take seconds, it
+  // is left to device thread
+  device_thread = std::make_unique<std::thread>(&AudioMixer::run_devices, this);
+  event_thread = std::make_unique<std::thread>(&AudioMixer::run_events, this);
+}
+
+AudioMixer::~AudioMixer() {
+  device_quit = true;
+  device_thread->join();
+  event_quit = true;
+  events_cv.notify_all();
+  event_thread->join();
+
+  // streams are closed, decoders retired by last buffers are left
+  Decoder *decoder;
+  while(retired.pop(decoder))
+    delete decoder;
+}
+
+void AudioMixer::scan_devices(void) {
+  scan_requested = true;
+}
+
+bool AudioMixer::is_ready(void) {
+  return devices_ready;
+}
+
+void AudioMixer::set_devices_callback(std::function<void()> callback) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  devices_callback = callback;
+}
+
+void AudioMixer::set_sample_cache(std::shared_ptr<SampleCache> cache) {
+  std::unique_lock<std::mutex> mlock(sample_cache_mutex);
+  sample_cache = cache;
+}
+
+std::shared_ptr<SampleCache> AudioMixer::get_sample_cache(void) {
+  std::unique_lock<std::mutex> mlock(sample_cache_mutex);
+  return sample_cache;
+}
+
+std::vector<std::string> AudioMixer::get_devices() {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  std::vector<std::string> names;
+  for(auto const& device: devices)
+    names.push_back(device.second);
+  return names;
+}
+
+void AudioMixer::run_devices(void) {
+#ifdef __linux__
+  // sound device nodes come and go with hot plugged interfaces
+  int inotify_fd = inotify_init1(IN_NONBLOCK);
+  if(inotify_fd >= 0 && inotify_add_watch(inotify_fd, "/dev/snd", IN_CREATE | IN_DELETE) < 0) {
+    ::close(inotify_fd);
+    inotify_fd = -1;
+  }
+#endif
+
+  // a device was plugged or unplugged, or a rescan was asked while playing,
+  // PortAudio is reinitialized once nothing plays
+  bool hotplug = false;
+
+  while(!device_quit) {
+    // output stopped, its device was unplugged or its server went away
+    // and it has to move right away, hot plug event or not
+    bool lost = is_output_lost();
+    if(scan_requested.exchange(false) || lost || (hotplug && is_idle())) {
+      // players keep playing on a working output, devices are listed again
+      // without reinitializing until they are done
+      bool reinitialize = !streams[owner].stream || is_idle() || lost;
+      hotplug = !reinitialize;
+      open_requested = false;
+      scan(reinitialize);
+
+      std::unique_lock<std::mutex> mlock(devices_mutex);
+      if(devices_callback)
+        devices_callback();
+    }
+    else if(open_requested.exchange(false)) {
+      reopen();
+    }
+    else if(calibrate_requested.exchange(false)) {
+      run_calibration();
+    }
 
+    // wake up regularly to check requests
+#ifdef __linux__
+    if(inotify_fd >= 0) {
+      struct pollfd pfd = {inotify_fd, POLLIN, 0};
+      if(poll(&pfd, 1, 100) > 0) {
+        char buffer[4096];
+        while(read(inotify_fd, buffer, sizeof(buffer)) > 0);
+        hotplug = true;
+      }
+      continue;
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+#ifdef __linux__
+  if(inotify_fd >= 0)
+    ::close(inotify_fd);
+#endif
+
+  {
+    std::unique_lock<std::mutex> mlock(stream_mutex);
+    close_stream(0);
+    close_stream(1);
+  }
+
+  if(portaudio_initialized) {
+    auto err = Pa_Terminate();
+    if(err != paNoError)
+      std::cerr<<"ErrorH"<<Pa_GetErrorText(err)<<"\n";
+  }
+}
+
+void AudioMixer::scan(bool reinitialize) {
+  // PortAudio only enumerates devices when initialized, and can only be
+  // reinitialized once streams are closed
+  if(reinitialize || !portaudio_initialized) {
+    {
+      std::unique_lock<std::mutex> mlock(stream_mutex);
+      close_stream(0);
+      close_stream(1);
+    }
+    if(portaudio_initialized) {
+      auto err = Pa_Terminate();
+      if(err != paNoError)
+        std::cerr<<"ErrorH"<<Pa_GetErrorText(err)<<"\n";
+      portaudio_initialized = false;
+    }
+
+    auto err = Pa_Initialize();
+    if(err != paNoError) {
+      std::cerr<<"ErrorF"<<Pa_GetErrorText(err)<<"\n";
+      return;
+    }
+    portaudio_initialized = true;
+  }
 
   std::map<PaHostApiIndex,std::string> api_names;
   // iterate over host APIs
@@ -279,6 +728,8 @@ AudioMixer::AudioMixer() {
   }
 
   // iterate over devices
+  std::vector<std::pair<PaDeviceIndex,std::string>> _devices;
+  std::map<std::string, std::vector<OutputFormat>> _formats;
   auto ndevices = Pa_GetDeviceCount();
   if(ndevices < 0)
     std::cerr<<"ErrorG"<<Pa_GetErrorText(ndevices)<<"\n";
@@ -291,21 +742,124 @@ AudioMixer::AudioMixer() {
     
     auto api_name = api_names[devinfo->hostApi];
     auto name = api_name + ":" + std::string(devinfo->name);
-    devices.push_back({i,name});
+    _devices.push_back({i,name});
+
+    // sample formats accepted at native rate
+    for(auto format: {OUTPUT_FORMAT_FLOAT32, OUTPUT_FORMAT_INT32,
+        OUTPUT_FORMAT_INT24, OUTPUT_FORMAT_INT16}) {
+      PaStreamParameters op;
+      op.device = i;
+      op.channelCount = 2;
+      op.sampleFormat = get_portaudio_format(format);
+      op.suggestedLatency = devinfo->defaultLowOutputLatency;
+      op.hostApiSpecificStreamInfo = NULL;
+      if(Pa_IsFormatSupported(NULL, &op, devinfo->defaultSampleRate) == paFormatIsSupported)
+        _formats[name].push_back(format);
+    }
   }
 
-  set_device(get_default_device());
+  {
+    std::unique_lock<std::mutex> mlock(devices_mutex);
+    devices = _devices;
+    device_formats = _formats;
+  }
+  devices_ready = true;
+
+  // device indexes may have changed, selected device is looked up by name,
+  // stream left running is kept as long as it plays selected device
+  reopen();
 }
 
-AudioMixer::~AudioMixer() {
+void AudioMixer::reopen(void) {
+  if(!portaudio_initialized)
+    return;
+
+  std::string name;
+  OutputFormat format;
+  unsigned long frames;
+  {
+    std::unique_lock<std::mutex> mlock(devices_mutex);
+    name = device_name;
+    format = output_format;
+    frames = output_buffer_frames;
+  }
+  auto idx = get_device_by_name(name);
+  if(idx == paNoDevice)
+    idx = Pa_GetDefaultOutputDevice();
+
+  const int current = owner;
+  auto const& s = streams[current];
+  if(s.stream && idx == current_device && format == s.format && frames == s.frames_per_buffer)
+    return;
+
+  // nothing is playing yet, mix straight into new stream
+  if(!streams[current].stream) {
+    std::unique_lock<std::mutex> mlock(stream_mutex);
+    current_device = idx;
+    open_stream(idx, current, format, frames);
+    return;
+  }
 
-  auto err = Pa_Terminate();
-  if(err != paNoError)
-    std::cerr<<"ErrorH"<<Pa_GetErrorText(err)<<"\n";
+  // open new device next to current one, it stays silent until current
+  // stream hands mixing over
+  const int next = 1 - current;
+  bool opened;
+  {
+    std::unique_lock<std::mutex> mlock(stream_mutex);
+    opened = open_stream(idx, next, format, frames);
+  }
+
+  if(!opened) {
+    // some devices can not be opened twice, fall back to close then open
+    std::unique_lock<std::mutex> mlock(stream_mutex);
+    close_stream(current);
+    current_device = idx;
+    open_stream(idx, current, format, frames);
+    return;
+  }
+
+  handover = true;
+  auto deadline = std::chrono::steady_clock::now()
+    + std::chrono::duration<double>(HANDOVER_TIMEOUT_SECONDS);
+  while(owner == current && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // old stream is stalled, take mixing over from it
+  if(owner == current) {
+    std::cerr<<"output stream handover timed out\n";
+    std::unique_lock<std::mutex> plock(players_mutex);
+    handover = false;
+    streams[next].fade_in = true;
+    owner = next;
+  }
+
+  std::unique_lock<std::mutex> mlock(stream_mutex);
+  current_device = idx;
+  close_stream(current);
 }
 
-std::vector<std::pair<PaDeviceIndex,std::string>> AudioMixer::get_devices() {
-  return devices;
+bool AudioMixer::is_output_lost(void) {
+  auto now = std::chrono::steady_clock::now();
+  auto const& s = streams[owner];
+  unsigned callbacks = s.callbacks;
+  if(!s.stream || callbacks != watched_callbacks) {
+    watched_callbacks = callbacks;
+    watched_time = now;
+    return false;
+  }
+
+  // stream of an unplugged device is aborted or stops calling back
+  std::chrono::duration<double> stalled = now - watched_time;
+  return Pa_IsStreamActive(s.stream) != 1 || stalled.count() > OUTPUT_STALL_SECONDS;
+}
+
+bool AudioMixer::is_idle(void) {
+  std::unique_lock<std::recursive_mutex> registry_lock(registry_mutex);
+  for(auto const& slot: slots) {
+    if(slot.player && slot.player->is_playing())
+      return false;
+  }
+  return true;
 }
 
 void AudioMixer::set_mode(AudioMixerMode mode) {
@@ -321,21 +875,639 @@ AudioMixerMode AudioMixer::get_mode(void) {
 }
 
 AudioPlayerID AudioMixer::new_player() {
-  next_audio_player_id++;
-  players[next_audio_player_id] = std::make_shared<AudioPlayer>(this);
-  return next_audio_player_id;
+  std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+
+  uint16_t index;
+  if(!free_slots.empty()) {
+    index = free_slots.back();
+    free_slots.pop_back();
+  }
+  else {
+    if(slots.size() > 0xffff) {
+      std::cerr<<"ErrorJ"<<"too many players\n";
+      return 0;
+    }
+    // audio callback skips commands while slots grow
+    std::unique_lock<std::mutex> mlock(players_mutex);
+    index = slots.size();
+    slots.push_back({nullptr, 1});
+  }
+
+  // player state is read by audio callback, keep it in locked memory. It is
+  // built before audio callback may see it.
+  auto& slot = slots[index];
+  AudioPlayerID id = ((AudioPlayerID)slot.generation << 16) | index;
+  auto player = std::allocate_shared<AudioPlayer>(ArenaAllocator<AudioPlayer>(), this, id);
+  std::unique_lock<std::mutex> mlock(players_mutex);
+  slot.player = std::move(player);
+  return id;
+}
+
+std::shared_ptr<AudioPlayer> const& AudioMixer::lookup(AudioPlayerID id) {
+  static const std::shared_ptr<AudioPlayer> none;
+  size_t index = get_player_slot(id);
+  if(index >= slots.size() || slots[index].generation != (id >> 16))
+    return none;
+  return slots[index].player;
+}
+
+AudioPlayer *AudioMixer::get_player(AudioPlayerID id) {
+  std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+  return lookup(id).get();
+}
+
+AudioPlayerID AudioMixer::get_player_at(int x, int y) {
+  std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+  for(auto const& slot: slots) {
+    if(slot.player && slot.player->is_at_position(x, y))
+      return slot.player->id;
+  }
+  return 0;
 }
 
-std::shared_ptr<AudioPlayer> AudioMixer::get_player(AudioPlayerID uid) {
-  return players.find(uid)->second;
+void AudioMixer::get_player_states(std::vector<audio_player_state_t> &states) {
+  std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+  states.resize(slots.size());
+  for(size_t i=0; i<slots.size(); i++) {
+    auto const& player = slots[i].player;
+    if(!player) {
+      states[i] = {0, false, false, 0.0, 0};
+      continue;
+    }
+    states[i] = {player->id, player->is_playing(), player->is_armed(),
+      player->level, player->position};
+  }
+}
+
+size_t AudioMixer::get_player_slot(AudioPlayerID id) {
+  return id & 0xffff;
 }
 
 void AudioMixer::remove_player(AudioPlayerID id) {
-  get_player(id)->close();
-  players.erase(id);
+  std::shared_ptr<AudioPlayer> player;
+  {
+    std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+    {
+      std::unique_lock<std::mutex> mlock(players_mutex);
+      if(!lookup(id))
+        return;
+
+      auto& slot = slots[get_player_slot(id)];
+      player = std::move(slot.player);
+      slot.player = nullptr;
+      // invalidate handles of removed player, 0 is not a valid generation
+      if(++slot.generation == 0)
+        slot.generation = 1;
+    }
+    free_slots.push_back(get_player_slot(id));
+
+    // audio callback drops its voice on next buffer, player is destroyed
+    // once it is out of voices
+    player->removed = true;
+    removed_players.push_back(player);
+  }
+
+  // decoder threads are joined outside of mixer locks
+  player->close();
+  release_removed_players();
+}
+
+void AudioMixer::release_removed_players(void) {
+  std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+  removed_players.erase(std::remove_if(removed_players.begin(), removed_players.end(),
+    [](std::shared_ptr<AudioPlayer> const& player) {
+      return !player->in_voices;
+    }), removed_players.end());
+}
+
+bool AudioMixer::post(const AudioMixerCommands &batch) {
+  if(batch.empty())
+    return false;
+
+  if(!commands.push(batch.data(), batch.size())) {
+    std::cerr<<"ErrorI"<<"mixer command queue full\n";
+    return false;
+  }
+  return true;
+}
+
+void AudioMixer::collect_trigger(AudioPlayerID id, float fade_seconds,
+  AudioMixerCommands &batch, uint64_t frame) {
+  // snapshot player and all other members of its trigger group
+  std::vector<std::shared_ptr<AudioPlayer>> members;
+  std::vector<std::shared_ptr<AudioPlayer>> others;
+  {
+    std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+    auto const& target = lookup(id);
+    if(!target)
+      return;
+    auto group = target->get_trigger_group();
+    for(auto const& slot: slots) {
+      auto const& player = slot.player;
+      if(!player)
+        continue;
+      bool member = (player == target)
+        || (!group.empty() && player->get_trigger_group() == group);
+      if(member)
+        members.push_back(player);
+      else
+        others.push_back(player);
+    }
+  }
+
+  std::set<std::string> chokes;
+  for(auto const& player: members) {
+    if(!player->is_stream_valid())
+      continue;
+
+    // decoder at start of file is built here, off the audio path, unless
+    // one is ready. A playing member is restarted by mixer on the frame
+    // start is scheduled for.
+    std::unique_lock<std::recursive_mutex> control_lock(player->control_mutex);
+    if(!player->is_armed() && !player->prepare())
+      continue;
+    player->pending_frame = frame;
+    player->pending = true;
+    batch.push_back({MIXER_COMMAND_START, player->id, fade_seconds, frame});
+
+    auto choke = player->get_choke_group();
+    if(!choke.empty())
+      chokes.insert(choke);
+  }
+
+  // stop players silenced by starting members
+  float choke_seconds = fade_seconds < 0 ? CHOKE_FADE_SECONDS : fade_seconds;
+  for(auto const& player: others) {
+    if(chokes.count(player->get_choke_group()))
+      batch.push_back({MIXER_COMMAND_STOP, player->id, choke_seconds, frame});
+  }
+}
+
+void AudioMixer::collect_stop(AudioPlayerID id, float fade_seconds,
+  AudioMixerCommands &batch, uint64_t frame) {
+  {
+    std::unique_lock<std::recursive_mutex> rlock(registry_mutex);
+    auto const& player = lookup(id);
+    if(!player)
+      return;
+    // cancel start if mixer would only pick it up after this stop, a stop
+    // following start is resolved by mixer on its own frame
+    if(player->pending && frame < player->pending_frame)
+      player->pending = false;
+  }
+  batch.push_back({MIXER_COMMAND_STOP, id, fade_seconds, frame});
+}
+
+bool AudioMixer::trigger(AudioPlayerID id) {
+  AudioMixerCommands batch;
+  collect_trigger(id, -1, batch);
+  return post(batch);
+}
+
+bool AudioMixer::crossfade(AudioPlayerID from, AudioPlayerID to, float seconds) {
+  AudioMixerCommands batch;
+  seconds = std::max(0.0f, seconds);
+
+  collect_trigger(to, seconds, batch);
+  if(batch.empty())
+    return false;
+
+  // stop commands come last, player may already be choked by this batch
+  batch.push_back({MIXER_COMMAND_STOP, from, seconds, 0});
+  return post(batch);
+}
+
+void AudioMixer::apply(const audio_mixer_command_t &command, unsigned long offset) {
+  // command may target a player removed since it was posted
+  auto player = lookup(command.id).get();
+  if(!player)
+    return;
+
+  switch(command.type) {
+
+    case MIXER_COMMAND_START: {
+      // player may have been stopped since start was requested, voices
+      // never grow past their capacity
+      bool full = !player->in_voices && voices.size() == MAX_VOICES;
+      if(player->pending.exchange(false) && !full) {
+        // playing voice is heard again once faded out
+        double delay = 0.0;
+        if(player->active) {
+          // fade playing voice out, mix() restarts it once faded
+          player->fade(0.0, CHOKE_FADE_SECONDS, true, offset);
+          player->restart_pending = true;
+          player->restart_fade = command.value;
+          delay = CHOKE_FADE_SECONDS;
+        }
+        else if(player->swap_decoder())
+          player->start_voice(command.value, offset);
+        else
+          break;
+        // voice released in previous buffer may not have left voices yet,
+        // it must not be pushed twice
+        if(!player->in_voices) {
+          voices.push_back(player);
+          player->in_voices = true;
+        }
+        if(!player->active)
+          post_event(MIXER_EVENT_STARTED, command.id);
+        player->active = true;
+
+        if(command.time > 0) {
+          // first frame of voice reaches the DAC offset frames after buffer
+          double latency = dac_time + offset/get_samplerate() + delay - command.time;
+          std::unique_lock<std::mutex> llock(trigger_latency_mutex, std::try_to_lock);
+          if(llock.owns_lock()) {
+            auto& l = trigger_latency;
+            l.count++;
+            l.last_s = latency;
+            l.min_s = (l.count == 1) ? latency : std::min(l.min_s, latency);
+            l.max_s = (l.count == 1) ? latency : std::max(l.max_s, latency);
+            l.mean_s += (latency - l.mean_s)/l.count;
+          }
+        }
+      }
+      break;
+    }
+
+    case MIXER_COMMAND_STOP: {
+      if(player->active) {
+        float seconds = command.value < 0 ? player->get_fade_out() : command.value;
+        // envelopes of a voice starting later in this buffer begin with it
+        player->fade(0.0, seconds, true, offset - std::min(offset, player->start_offset));
+        player->restart_pending = false;
+      }
+      break;
+    }
+
+    case MIXER_COMMAND_GAIN: {
+      player->set_gain(command.value);
+      break;
+    }
+
+    case MIXER_COMMAND_MUTE: {
+      player->set_mute(command.value != 0);
+      break;
+    }
+  }
+}
+
+bool AudioMixer::retire_decoder(AudioPlayer *player) {
+  if(!player->decoder)
+    return true;
+  if(!retired.push(player->decoder.get()))
+    return false;
+  player->decoder.release();
+  // event thread destroys it once buffer is mixed
+  events_posted = true;
+  return true;
+}
+
+void AudioMixer::post_event(AudioMixerEventType type, AudioPlayerID id) {
+  // gui fell behind, its periodic refresh catches up with player states
+  if(events.push({type, id}))
+    events_posted = true;
+}
+
+bool AudioMixer::pop_event(audio_mixer_event_t &event) {
+  return events.pop(event);
+}
+
+void AudioMixer::set_events_callback(std::function<void()> callback) {
+  std::unique_lock<std::mutex> mlock(events_mutex);
+  events_callback = callback;
+}
+
+void AudioMixer::run_events(void) {
+  std::unique_lock<std::mutex> mlock(events_mutex);
+  while(!event_quit) {
+    // decoders are destroyed here as it joins their threads
+    Decoder *decoder;
+    while(retired.pop(decoder))
+      delete decoder;
+    release_removed_players();
+
+    // audio callback never takes events mutex, a notification sent right
+    // before waiting is lost and caught by timeout instead
+    if(!events_pending.exchange(false)) {
+      events_cv.wait_for(mlock, std::chrono::milliseconds(100));
+      continue;
+    }
+    if(events_callback)
+      events_callback();
+  }
+}
+
+int AudioMixer::portaudio_mix_callback(
+      const void *input_buffer,
+      void *output_buffer,
+      unsigned long frames_per_buffer,
+      const PaStreamCallbackTimeInfo *time_info,
+      PaStreamCallbackFlags status_flags,
+      void *data) {
+  (void)time_info;
+  (void)input_buffer;
+
+  audio_mixer_stream_t *s = static_cast<audio_mixer_stream_t*>(data);
+  AudioMixer *mixer = s->mixer;
+
+  // only one stream mixes players, the other one plays silence
+  const int slot = s - mixer->streams;
+  if(mixer->owner != slot) {
+    s->converter.silence(output_buffer, frames_per_buffer);
+    return paContinue;
+  }
+
+  // time spent mixing is checked against buffer duration
+  auto callback_start = std::chrono::steady_clock::now();
+  if(status_flags & paOutputUnderflow)
+    s->xruns++;
+
+  // bus was reserved when stream was opened, never allocate here
+  if(frames_per_buffer > s->bus_left.capacity()) {
+    // stream is alive, it is not taken for a lost one
+    s->callbacks++;
+    s->xruns++;
+    s->converter.silence(output_buffer, frames_per_buffer);
+    return paContinue;
+  }
+
+  // players mix into planar bus, interleaved once at the end
+  s->bus_left.assign(frames_per_buffer, 0.0f);
+  s->bus_right.assign(frames_per_buffer, 0.0f);
+  float *left = s->bus_left.data();
+  float *right = s->bus_right.data();
+
+  if(s->fade_in.exchange(false)) {
+    // stream took over mixing, players now resample to its rate
+    mixer->samplerate_hz = s->samplerate_hz;
+    s->bus_ramp.reset(0.0);
+    s->bus_ramp.start(1.0, BUS_FADE_SECONDS*s->samplerate_hz, GAIN_RAMP_LINEAR);
+    s->handing_over = false;
+  }
+  if(mixer->handover && !s->handing_over) {
+    s->bus_ramp.start(0.0, BUS_FADE_SECONDS*s->samplerate_hz, GAIN_RAMP_LINEAR);
+    s->handing_over = true;
+  }
+
+  // publish when this buffer will be heard, for event scheduling
+  const uint64_t now = mixer->clock;
+  double dac = time_info->outputBufferDacTime;
+  if(dac == 0) {
+    // host API does not report DAC time
+    dac = time_info->currentTime;
+  }
+  mixer->dac_sequence++;
+  mixer->dac_frame = now;
+  mixer->dac_time = dac;
+  mixer->buffer_frames = frames_per_buffer;
+  mixer->dac_sequence++;
+
+  // players are being added or removed, commands wait for next buffer
+  std::unique_lock<std::mutex> plock(mixer->players_mutex, std::try_to_lock);
+  if(plock.owns_lock()) {
+    // apply scheduled commands due in this buffer, keeping later ones
+    const uint64_t end = now + frames_per_buffer;
+    auto& scheduled = mixer->scheduled;
+    size_t kept = 0;
+    for(size_t i=0; i<scheduled.size(); i++) {
+      auto const& command = scheduled[i];
+      if(command.frame < end)
+        mixer->apply(command, command.frame > now ? command.frame - now : 0);
+      else
+        scheduled[kept++] = command;
+    }
+    scheduled.resize(kept);
+
+    // apply pending commands, all of them take effect on first frame of
+    // this buffer unless they target a later frame
+    audio_mixer_command_t command;
+    while(mixer->commands.pop(command)) {
+      if(command.frame >= end && scheduled.size() < MAX_SCHEDULED_COMMANDS) {
+        scheduled.push_back(command);
+        continue;
+      }
+      // late commands (or scheduled commands overflow) are applied right away
+      unsigned long offset = 0;
+      if(command.frame > now)
+        offset = std::min<uint64_t>(command.frame - now, frames_per_buffer - 1);
+      mixer->apply(command, offset);
+    }
+    plock.unlock();
+  }
+
+  // mix all active players, voices of removed players are dropped
+  auto& voices = mixer->voices;
+  for(size_t i=0; i<voices.size();) {
+    auto player = voices[i];
+    if(player->active && !player->removed && player->mix(left, right, frames_per_buffer)) {
+      i++;
+      continue;
+    }
+    // end of file reached, voice released or player closed
+    player->active = false;
+    player->set_level(0.0);
+    // decoder is kept until next start if it can not be retired now
+    mixer->retire_decoder(player);
+    voices[i] = voices.back();
+    voices.pop_back();
+    mixer->post_event(MIXER_EVENT_FINISHED, player->id);
+    // removed player may be destroyed from now on
+    player->in_voices = false;
+  }
+
+  // wake up event thread once per buffer, and only if it is not awake yet
+  if(mixer->events_posted) {
+    mixer->events_posted = false;
+    if(!mixer->events_pending.exchange(true))
+      mixer->events_cv.notify_one();
+  }
+
+  // route mix bus according to mixer mode
+  auto mode = mixer->get_mode();
+  if(mode != MIXER_MODE_STEREO) {
+    const float lg = (mode == MIXER_MODE_FULL_LEFT) ? 1.0f : 0.0f;
+    const float rg = (mode == MIXER_MODE_FULL_RIGHT) ? 1.0f : 0.0f;
+    for(unsigned long i=0; i<frames_per_buffer; i++) {
+      float m = (left[i] + right[i])/2;
+      left[i] = lg*m;
+      right[i] = rg*m;
+    }
+  }
+
+  // fade bus while output moves between devices
+  auto& ramp = s->bus_ramp;
+  if(ramp.get_remaining() > 0 || ramp.get_value() != 1.0f) {
+    const unsigned long BLOCK = 256;
+    float gains[BLOCK];
+    for(unsigned long i=0; i<frames_per_buffer; i+=BLOCK) {
+      unsigned long m = std::min(BLOCK, frames_per_buffer - i);
+      ramp.render(gains, m);
+      for(unsigned long k=0; k<m; k++)
+        left[i+k] *= gains[k];
+      for(unsigned long k=0; k<m; k++)
+        right[i+k] *= gains[k];
+    }
+  }
+
+  // interleave for device, in its sample format
+  s->converter.interleave(left, right, output_buffer, frames_per_buffer);
+
+  mixer->clock += frames_per_buffer;
+
+  // synthetic voices stand for players during calibration
+  if(mixer->calibration_voices > 0)
+    mixer->render_calibration_load(frames_per_buffer);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - callback_start;
+  if(elapsed.count() > CALIBRATION_DEADLINE*frames_per_buffer/s->samplerate_hz)
+    s->late_callbacks++;
+  s->callbacks++;
+
+  // bus faded out, other stream mixes from its next buffer
+  if(s->handing_over && ramp.get_remaining() == 0) {
+    s->handing_over = false;
+    mixer->streams[1 - slot].fade_in = true;
+    mixer->handover = false;
+    mixer->owner = 1 - slot;
+  }
+
+  return paContinue;
+}
+
+double AudioMixer::get_samplerate(void) {
+  return samplerate_hz;
+}
+
+uint64_t AudioMixer::get_clock(void) {
+  return clock;
+}
+
+audio_mixer_latency_t AudioMixer::get_trigger_latency(void) {
+  std::unique_lock<std::mutex> mlock(trigger_latency_mutex);
+  return trigger_latency;
+}
+
+double AudioMixer::get_stream_time(void) {
+  // never wait for device thread, events are then played on next buffer
+  std::unique_lock<std::mutex> mlock(stream_mutex, std::try_to_lock);
+  auto stream = streams[owner].stream;
+  if(!mlock.owns_lock() || !stream)
+    return 0.0;
+  return Pa_GetStreamTime(stream);
+}
+
+uint64_t AudioMixer::get_schedule_frame(double stream_time) {
+  // read consistent frame/time pair of last mixed buffer
+  uint64_t frame;
+  double time;
+  unsigned long n;
+  unsigned sequence;
+  do {
+    sequence = dac_sequence;
+    frame = dac_frame;
+    time = dac_time;
+    n = buffer_frames;
+  } while((sequence & 1) || sequence != dac_sequence);
+
+  if(n == 0 || stream_time <= 0)
+    return 0;
+
+  // frame heard at event time, delayed by output latency plus one buffer so
+  // it always lands in a buffer not mixed yet
+  double latency = streams[owner].output_latency;
+  double delta = (stream_time - time + latency)*get_samplerate() + n;
+  if(delta <= 0)
+    return frame;
+  return frame + (uint64_t)delta;
+}
+
+bool AudioMixer::open_stream(PaDeviceIndex idx, int slot, OutputFormat format,
+  unsigned long frames_per_buffer) {
+  if(idx == paNoDevice)
+    return false;
+
+  auto devinfo = Pa_GetDeviceInfo(idx);
+  if(!devinfo)
+    return false;
+
+  // mix at device native rate, players resample to it. Mixer clock keeps
+  // counting across devices so scheduled commands stay valid.
+  auto& s = streams[slot];
+  s.samplerate_hz = devinfo->defaultSampleRate;
+  s.handing_over = false;
+  s.fade_in = true;
+  s.format = format;
+  s.converter.set_format(format);
+  s.frames_per_buffer = frames_per_buffer;
+  // stream callback mixes into bus without ever growing it
+  s.bus_left.reserve(std::max(frames_per_buffer, MAX_BUFFER_FRAMES));
+  s.bus_right.reserve(std::max(frames_per_buffer, MAX_BUFFER_FRAMES));
+  if(slot == owner)
+    samplerate_hz = s.samplerate_hz;
+
+  // set up PA parameters
+  PaStreamParameters op;
+  op.device = idx;
+  op.channelCount = 2;
+  op.sampleFormat = get_portaudio_format(s.converter.get_format());
+  // fixed buffer size asks for matching latency, host API picks otherwise
+  op.suggestedLatency = frames_per_buffer > 0
+    ? frames_per_buffer/s.samplerate_hz : 0.1;
+  op.hostApiSpecificStreamInfo = NULL;
+  // start PA stream
+  auto err = Pa_OpenStream(
+    &s.stream,
+    NULL, /*inputParameters*/
+    &op,
+    s.samplerate_hz,
+    frames_per_buffer > 0 ? frames_per_buffer : paFramesPerBufferUnspecified,
+    0, /*flags*/
+    AudioMixer::portaudio_mix_callback,
+    (void*)&s);
+
+  if(err != paNoError && s.converter.get_format() != OUTPUT_FORMAT_FLOAT32) {
+    // device refused selected format, let host API convert from float
+    std::cerr<<"ErrorE"<<Pa_GetErrorText(err)<<", falling back to float output\n";
+    s.converter.set_format(OUTPUT_FORMAT_FLOAT32);
+    op.sampleFormat = paFloat32;
+    err = Pa_OpenStream(&s.stream, NULL, &op, s.samplerate_hz,
+      frames_per_buffer > 0 ? frames_per_buffer : paFramesPerBufferUnspecified,
+      0, AudioMixer::portaudio_mix_callback, (void*)&s);
+  }
+
+  if(err != paNoError) {
+    std::cerr<<"ErrorE"<<Pa_GetErrorText(err)<<"\n";
+    s.stream = NULL;
+    return false;
+  }
+
+  auto info = Pa_GetStreamInfo(s.stream);
+  s.output_latency = info ? info->outputLatency : 0.0;
+
+  err = Pa_StartStream(s.stream);
+  if(err != paNoError) {
+    std::cerr<<"ErrorB"<<Pa_GetErrorText(err)<<"\n";
+    close_stream(slot);
+    return false;
+  }
+
+  return true;
+}
+
+void AudioMixer::close_stream(int slot) {
+  auto& s = streams[slot];
+  if(!s.stream)
+    return;
+
+  auto err = Pa_CloseStream(s.stream);
+  if(err != paNoError)
+    std::cerr<<"ErrorA"<<Pa_GetErrorText(err)<<"\n";
+  s.stream = NULL;
 }
 
 std::string AudioMixer::get_device_name(PaDeviceIndex idx) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
   for(auto const& device: devices) {
     if(device.first == idx)
       return device.second;
@@ -344,6 +1516,7 @@ std::string AudioMixer::get_device_name(PaDeviceIndex idx) {
 }
 
 PaDeviceIndex AudioMixer::get_device_by_name(const std::string &name) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
   for(auto const& device: devices) {
     if(device.second == name) {
       return device.first;
@@ -352,19 +1525,152 @@ PaDeviceIndex AudioMixer::get_device_by_name(const std::string &name) {
   return paNoDevice;
 }
 
-PaDeviceIndex AudioMixer::get_device(void) {
-  return current_device;
+std::string AudioMixer::get_device(void) {
+  return get_device_name(current_device);
 }
 
-void AudioMixer::set_device(PaDeviceIndex idx) {
-  current_device = idx;
-  // iterate over all players to stop them
-  for(auto const&  item: players) {
-    auto const& player = item.second;
-    player->stop();
+std::vector<OutputFormat> AudioMixer::get_device_formats(const std::string &name) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  auto it = device_formats.find(name);
+  if(it == device_formats.end())
+    return std::vector<OutputFormat>();
+  return it->second;
+}
+
+void AudioMixer::set_output_format(OutputFormat format) {
+  {
+    std::unique_lock<std::mutex> mlock(devices_mutex);
+    output_format = format;
   }
+  open_requested = true;
+}
+
+OutputFormat AudioMixer::get_output_format(void) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  return output_format;
 }
 
-PaDeviceIndex AudioMixer::get_default_device() {
-  return Pa_GetDefaultOutputDevice();
+void AudioMixer::set_output_buffer_frames(unsigned long frames) {
+  {
+    std::unique_lock<std::mutex> mlock(devices_mutex);
+    output_buffer_frames = frames;
+  }
+  open_requested = true;
+}
+
+unsigned long AudioMixer::get_output_buffer_frames(void) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  return output_buffer_frames;
+}
+
+std::vector<unsigned long> AudioMixer::get_buffer_sizes(void) {
+  return {32, 64, 128, 256, 512, 1024, 2048};
+}
+
+void AudioMixer::calibrate(void) {
+  calibrating = true;
+  calibrate_requested = true;
+}
+
+void AudioMixer::set_calibration_callback(std::function<void(unsigned long)> callback) {
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  calibration_callback = callback;
+}
+
+bool AudioMixer::is_calibrating(void) {
+  return calibrating;
+}
+
+void AudioMixer::run_calibration(void) {
+  unsigned long previous = get_output_buffer_frames();
+  unsigned long chosen = 0;
+
+  auto sizes = get_buffer_sizes();
+  if(!portaudio_initialized || !is_idle()) {
+    std::cerr<<"calibration needs an idle output\n";
+  }
+  else {
+    // synthetic voices resample the same block of noise
+    calibration_source.resize(2*sizes.back());
+    calibration_mix.resize(sizes.back());
+    unsigned seed = 1;
+    for(auto& v: calibration_source) {
+      seed = seed*1664525 + 1013904223;
+      v = (int32_t)seed/2147483648.0f;
+    }
+
+    // largest size first, stop at first one playing with dropouts
+    unsigned long stable = 0;
+    for(auto it = sizes.rbegin(); it != sizes.rend() && !device_quit; ++it) {
+      {
+        std::unique_lock<std::mutex> mlock(devices_mutex);
+        output_buffer_frames = *it;
+      }
+      reopen();
+      auto& s = streams[owner];
+      if(!s.stream || s.frames_per_buffer != *it)
+        break;
+
+      // first buffers of a new stream are not representative
+      std::this_thread::sleep_for(std::chrono::duration<double>(CALIBRATION_SETTLE_SECONDS));
+      s.callbacks = 0;
+      s.xruns = 0;
+      s.late_callbacks = 0;
+      calibration_voices = CALIBRATION_VOICES;
+      std::this_thread::sleep_for(std::chrono::duration<double>(CALIBRATION_SECONDS));
+      calibration_voices = 0;
+
+      std::cerr<<"calibration "<<*it<<" frames: "<<s.callbacks<<" buffers, "
+        <<s.xruns<<" dropouts, "<<s.late_callbacks<<" late\n";
+      if(s.callbacks == 0 || s.xruns > 0 || s.late_callbacks > 0)
+        break;
+      stable = *it;
+    }
+
+    // keep one size of margin above smallest stable one
+    if(stable > 0) {
+      auto it = std::find(sizes.begin(), sizes.end(), stable);
+      chosen = it + 1 != sizes.end() ? *(it + 1) : stable;
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> mlock(devices_mutex);
+    output_buffer_frames = chosen > 0 ? chosen : previous;
+  }
+  reopen();
+  calibrating = false;
+
+  std::unique_lock<std::mutex> mlock(devices_mutex);
+  if(calibration_callback)
+    calibration_callback(chosen);
+}
+
+void AudioMixer::render_calibration_load(unsigned long frames) {
+  // same work as a player: resample, apply gain and accumulate
+  const float *source = calibration_source.data();
+  float *mix = calibration_mix.data();
+  frames = std::min<unsigned long>(frames, calibration_mix.size());
+  std::fill(mix, mix + frames, 0.0f);
+
+  const unsigned voices = calibration_voices;
+  for(unsigned v=0; v<voices; v++) {
+    const double ratio = 1.0 + v*0.01;
+    const float gain = 1.0f/(v + 1);
+    for(unsigned long i=0; i<frames; i++) {
+      double position = i*ratio;
+      size_t k = (size_t)position;
+      float t = position - k;
+      mix[i] += gain*(source[k] + t*(source[k+1] - source[k]));
+    }
+  }
+}
+
+void AudioMixer::set_device(const std::string &name) {
+  {
+    std::unique_lock<std::mutex> mlock(devices_mutex);
+    device_name = name;
+  }
+  // players keep playing, output moves to new device
+  open_requested = true;
 }
@@ -2,15 +2,32 @@
 #define _AUDIOMIXER_HPP
 
 #include <memory>
+#include <vector>
 #include <map>
 #include <portaudio.h>
 #include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <chrono>
 
 #include "maddecoder.hpp"
 #include "wavdecoder.hpp"
+#include "cacheddecoder.hpp"
+#include "gainramp.hpp"
+#include "commandqueue.hpp"
+#include "eventqueue.hpp"
+#include "audioarena.hpp"
+#include "sampleconverter.hpp"
 
 class AudioMixer;
 
+// player handle, slot index in low 16 bits and slot generation in high 16
+// bits so handles of removed players are detected, 0 is never a valid handle
+using AudioPlayerID = uint32_t;
+
 enum AudioMixerMode {
   MIXER_MODE_STEREO = 1,
   MIXER_MODE_FULL_RIGHT,
@@ -19,64 +36,214 @@ enum AudioMixerMode {
 
 class AudioPlayer {
   public:
-    explicit AudioPlayer(AudioMixer *mixer);
+    AudioPlayer(AudioMixer *mixer, AudioPlayerID id);
     ~AudioPlayer();
 
+    // close player and prepare a decoder of file, played once player is
+    // started
     bool open(std::string filename);
 
-		static int portaudio_feed_callback(
-			const void *input_buffer,
-			void *output_buffer,
-			unsigned long frames_per_buffer,
-			const PaStreamCallbackTimeInfo *time_info,
-			PaStreamCallbackFlags status_flags,
-			void *data);
+    // mix at most n frames into planar stereo bus, called from the mixer
+    // audio callback, return false when end of file has been reached
+    bool mix(float *left, float *right, unsigned long n);
 
+    // ask mixer to start player (and its trigger group) on next buffer
 		bool play(void);
 
     bool is_playing(void);
 
+    // fade out and release voice, player keeps playing until fade is over
 		bool stop(void);
 
+    // fade out voice and forget file
 		bool close(void);
 
+    // fade out voice and prepare a new decoder at start of file
 		bool reset(void);
 
+    // prepare a decoder at start of file unless one is ready, players
+    // starting or playing are left alone
+    void arm(void);
+
 		float set_gain(float);
 		float get_gain(void);
+
+    // gain applied ahead of user gain to bring file to a common loudness
+    void set_normalization(float);
+    float get_normalization(void);
 		
     void set_mute(bool);
     bool get_mute();
 
 		void set_repeat(bool);
 
+    // envelope durations applied when player is started and stopped
+    void set_fade_in(float seconds);
+    float get_fade_in(void);
+    void set_fade_out(float seconds);
+    float get_fade_out(void);
+
+    void set_fade_shape(GainRampShape);
+    GainRampShape get_fade_shape(void);
+
     void set_level(float);
     float get_level(void);
 
+    // decoded frames played since file was opened, keeps growing across
+    // repeats
+    uint64_t get_position(void);
+
     std::string get_filename(void) { return filename;};
 
+    // only play frames [start, end) of file, end 0 meaning end of file,
+    // taken into account next time decoder is opened
+    void set_range(uint64_t start, uint64_t end);
+    uint64_t get_range_start(void);
+    uint64_t get_range_end(void);
+
+    // grid position of the pad driving this player
+    void set_position(int x, int y);
+    bool is_at_position(int x, int y);
+
+    // players sharing a trigger group name start on the same output frame
+    void set_trigger_group(const std::string &);
+    std::string get_trigger_group(void);
+
+    // starting a player silences all others sharing its choke group name
+    void set_choke_group(const std::string &);
+    std::string get_choke_group(void);
+
 	private:
+    friend class AudioMixer;
+
 	  AudioMixer* mixer;
 
-    // return true if stream as been created, false otherwise
+    AudioPlayerID id;
+
+    // return true if decoder as been created, false otherwise
     bool is_stream_valid(void);
 
-    // return current audio mixer mode
-    AudioMixerMode get_mixer_mode(void);
+    // decoder of file starting at range start, from file cache if possible
+    std::unique_ptr<Decoder> create_decoder(const std::string &filename);
 
-		PaStream *stream;
-		
+    // build decoder of current file off the audio path, replacing the one
+    // waiting to be started if any, control mutex held
+    bool prepare(void);
+
+    // drop decoder waiting to be started, a new one is built next time
+    // player is armed or triggered
+    void unprepare(void);
+
+    // a decoder is waiting to be started
+    bool is_armed(void);
+
+    // called from audio callback, make decoder waiting to be started the
+    // voice decoder, retiring current one. Return false if none is waiting.
+    bool swap_decoder(void);
+
+    // called from audio callback when voice becomes active offset frames
+    // into next mixed buffer, fade in over given seconds or player own fade
+    // in time when negative
+    void start_voice(float fade_seconds, unsigned long offset);
+
+    // called from audio callback, fade voice from its current envelope to
+    // target within seconds starting offset frames into next mixed buffer,
+    // voice is released when fade is over if asked to
+    void fade(float target, float seconds, bool release, unsigned long offset);
+
+    // mix at most MIX_BLOCK_FRAMES frames, raising peak to block signal
+    // envelope, return false when end of file has been reached
+    bool mix_block(float *left, float *right, unsigned long n, float &peak);
+
+    // normalization and user gains, or 0 when muted
+    float get_target_gain(void);
+
+    // duration of gain changes smoothing
+    static constexpr float GAIN_SMOOTHING_SECONDS = 0.02;
+    // default stop fade, long enough to avoid a click
+    static constexpr float DEFAULT_FADE_OUT_SECONDS = 0.01;
+    // frames mixed at once, scratch buffers are sized for a block
+    static const unsigned long MIX_BLOCK_FRAMES = 256;
+    // highest file to mixer sample rate ratio, e.g. 384kHz to 48kHz
+    static const unsigned MAX_RESAMPLE_RATIO = 8;
+
+    // serialize open/close/reset between gui and control threads
+    std::recursive_mutex control_mutex;
+
+    // decoder being played, owned by audio callback which hands it to the
+    // mixer event thread to be destroyed
 		std::unique_ptr<Decoder> decoder;
+    // decoder at start of file waiting to be started, built and dropped by
+    // control threads, taken by audio callback
+    std::atomic<Decoder*> next_decoder;
+
+    // decoded frames waiting to be resampled to mixer rate, one array per
+    // channel
+    ArenaVector<float> resampler_left;
+    ArenaVector<float> resampler_right;
+    // fractional read position in resampler frames
+    double resampler_position;
+
+    // mixing scratch buffers, reserved once and owned by audio thread
+    ArenaVector<float> mix_left;
+    ArenaVector<float> mix_right;
+    ArenaVector<float> mix_gains;
+    ArenaVector<float> mix_fades;
+
+    // smoothed user gain and fade envelope, owned by audio thread
+    GainRamp gain_ramp;
+    GainRamp fade_ramp;
+    // release voice when fade envelope is over
+    bool fade_release;
+    // silent frames before voice starts in next mixed buffer
+    unsigned long start_offset;
+    // voice restarts with a new decoder once faded out, fading in over
+    // restart fade seconds, owned by audio thread
+    bool restart_pending;
+    float restart_fade;
+
+    std::atomic<float> fade_in;
+    std::atomic<float> fade_out;
+    std::atomic<GainRampShape> fade_shape;
 
 		std::string filename;
 
 		std::atomic<float> gain;
 
+    std::atomic<float> normalization;
+
 		std::atomic<bool> repeat;
 
     std::atomic<bool> mute;
 
 		std::atomic<float> level;
+
+    std::atomic<uint64_t> position;
+
+    std::atomic<uint64_t> range_start;
+    std::atomic<uint64_t> range_end;
+
+    // start has been requested and will happen on next mixer buffer
+    std::atomic<bool> pending;
+    // mixer frame requested start is scheduled on, 0 for next buffer
+    std::atomic<uint64_t> pending_frame;
+    // player is currently rendered by mixer
+    std::atomic<bool> active;
+    // player is in mixer voices, written by audio callback only
+    std::atomic<bool> in_voices;
+    // player was removed from mixer, audio callback drops its voice
+    std::atomic<bool> removed;
+
+    std::atomic<int> xpos, ypos;
+
+    // decoder loop, error and underrun counts already reported, owned by
+    // audio thread
+    unsigned seen_loops;
+    unsigned seen_errors;
+    unsigned seen_underruns;
+
+    std::string trigger_group;
+    std::string choke_group;
 };
 
 
@@ -87,8 +254,107 @@ const std::vector<AudioMixerModePair> MIXER_MODES {
   {MIXER_MODE_FULL_LEFT, "all to left"},
 };
 
-using AudioPlayerID = int;
-using AudioPlayerMap = std::map<AudioPlayerID, std::shared_ptr<AudioPlayer>>;
+enum AudioMixerCommandType {
+  // start player, value is fade in seconds (negative for player default).
+  // A playing player is faded out quickly then started again.
+  MIXER_COMMAND_START = 1,
+  // fade out and release player, value is fade out seconds (negative for
+  // player default)
+  MIXER_COMMAND_STOP,
+  // set player gain to value
+  MIXER_COMMAND_GAIN,
+  // mute player when value is not zero
+  MIXER_COMMAND_MUTE,
+};
+
+// commands posted in the same batch are applied on the same mixer buffer
+typedef struct {
+  AudioMixerCommandType type;
+  AudioPlayerID id;
+  float value;
+  // mixer clock frame command takes effect on, 0 for next buffer
+  uint64_t frame;
+  // stream time start was requested at, used to measure trigger latency,
+  // 0 if not measured
+  double time;
+} audio_mixer_command_t;
+
+using AudioMixerCommands = std::vector<audio_mixer_command_t>;
+
+enum AudioMixerEventType {
+  // voice became active
+  MIXER_EVENT_STARTED = 1,
+  // voice reached end of file, was released or closed
+  MIXER_EVENT_FINISHED,
+  // decoder rewound at end of file or range
+  MIXER_EVENT_LOOPED,
+  // audio callback had to wait for decoder
+  MIXER_EVENT_UNDERRUN,
+  // decoder met undecodable data
+  MIXER_EVENT_DECODE_ERROR,
+};
+
+// pushed by audio callback, read by gui
+typedef struct {
+  AudioMixerEventType type;
+  AudioPlayerID id;
+} audio_mixer_event_t;
+
+// output stream and state its callback works with. The mixer keeps two of
+// them so a new device can be opened before the current one is closed.
+typedef struct {
+  AudioMixer *mixer;
+  PaStream *stream;
+  double samplerate_hz;
+  double output_latency;
+  // planar mix bus, interleaved into output buffer once mixed, owned by
+  // stream callback
+  ArenaVector<float> bus_left;
+  ArenaVector<float> bus_right;
+  // mix bus envelope, owned by stream callback
+  GainRamp bus_ramp;
+  // format selected when stream was opened, may be auto
+  OutputFormat format;
+  // frames per buffer stream was opened with, 0 when left to host API
+  unsigned long frames_per_buffer;
+  // buffers mixed, buffers the host reported a dropout on and buffers
+  // mixed too slowly since last reset, written by stream callback
+  std::atomic<unsigned> callbacks;
+  std::atomic<unsigned> xruns;
+  std::atomic<unsigned> late_callbacks;
+  // narrows mix bus to device sample format, owned by stream callback
+  SampleConverter converter;
+  // bus is fading out before mixing is handed over to other stream
+  bool handing_over;
+  // stream took over mixing and fades its bus in on next buffer
+  std::atomic<bool> fade_in;
+} audio_mixer_stream_t;
+
+// delay between a timed start request and its first frame reaching the DAC
+typedef struct {
+  unsigned long count;
+  double last_s;
+  double min_s;
+  double max_s;
+  double mean_s;
+} audio_mixer_latency_t;
+
+// player state as seen by gui, read for all players at once
+typedef struct {
+  // 0 for slots without player
+  AudioPlayerID id;
+  bool playing;
+  bool armed;
+  float level;
+  uint64_t position;
+} audio_player_state_t;
+
+// player registry entry, reused with a new generation once its player has
+// been removed
+typedef struct {
+  std::shared_ptr<AudioPlayer> player;
+  uint16_t generation;
+} audio_player_slot_t;
 
 class AudioMixer {
 
@@ -98,39 +364,314 @@ class AudioMixer {
 
     AudioPlayerID new_player(void);
 
-    std::shared_ptr<AudioPlayer> get_player(AudioPlayerID);
-    
+    // player of handle, null if it has been removed. Pointer stays valid
+    // until player is removed, which only its owner does.
+    AudioPlayer *get_player(AudioPlayerID);
+
+    // return player at pad grid position, 0 if none
+    AudioPlayerID get_player_at(int x, int y);
+
+    // state of all players, indexed by player slot
+    void get_player_states(std::vector<audio_player_state_t> &states);
+
+    // index of player state in get_player_states
+    static size_t get_player_slot(AudioPlayerID);
+
     void remove_player(AudioPlayerID);
 
-    std::vector<std::pair<PaDeviceIndex,std::string>> get_devices();
+    // post commands to audio callback, all applied on the same buffer
+    bool post(const AudioMixerCommands &);
+
+    // pop oldest event pushed by audio callback, return false if none left.
+    // Events must be popped from a single thread.
+    bool pop_event(audio_mixer_event_t &);
+
+    // called from event thread when events are waiting, at most once per
+    // mixed buffer
+    void set_events_callback(std::function<void()>);
 
-    std::string get_device_name(PaDeviceIndex idx);
+    // append commands starting player and all members of its trigger group
+    // on given mixer frame, stopping members of their choke groups
+    void collect_trigger(AudioPlayerID, float fade_seconds,
+      AudioMixerCommands &, uint64_t frame = 0);
 
-    PaDeviceIndex get_device_by_name(const std::string &name);
+    // append command stopping player. A start not done yet is cancelled if
+    // it is scheduled after the stop, otherwise the player starts and is
+    // stopped on the stop frame.
+    void collect_stop(AudioPlayerID, float fade_seconds,
+      AudioMixerCommands &, uint64_t frame = 0);
+
+    // start player and all members of its trigger group sample-aligned,
+    // silencing members of their choke groups in the same buffer
+    bool trigger(AudioPlayerID);
+
+    // start player (and its trigger group) fading in while other player
+    // fades out, both ramps starting on the same output frame
+    bool crossfade(AudioPlayerID from, AudioPlayerID to, float seconds);
+
+    static int portaudio_mix_callback(
+      const void *input_buffer,
+      void *output_buffer,
+      unsigned long frames_per_buffer,
+      const PaStreamCallbackTimeInfo *time_info,
+      PaStreamCallbackFlags status_flags,
+      void *data);
+
+    // output stream sample rate
+    double get_samplerate(void);
+
+    // number of frames rendered since output stream was opened
+    uint64_t get_clock(void);
+
+    // current time of output stream, in seconds
+    double get_stream_time(void);
+
+    // mixer frame an event that occured at given stream time should sound
+    // on, keeping a constant latency between events and output
+    uint64_t get_schedule_frame(double stream_time);
 
-    void set_device(PaDeviceIndex idx);
-    PaDeviceIndex get_default_device(void);
+    // latency statistics of start commands carrying a request time
+    audio_mixer_latency_t get_trigger_latency(void);
 
-    PaDeviceIndex get_device(void);
+    // list output devices again from device thread. PortAudio has to be
+    // reinitialized for devices plugged since last scan to show up, which
+    // closes output: while players play on a working output, devices are
+    // listed from current initialization and reinitialization waits until
+    // they are done. Output only moves if selected device disappeared.
+    void scan_devices(void);
+
+    // true once devices have been scanned at least once
+    bool is_ready(void);
+
+    // called from device thread whenever a scan is over
+    void set_devices_callback(std::function<void()>);
+
+    // names of usable output devices
+    std::vector<std::string> get_devices();
+
+    // select output device by name, default device is used when empty or
+    // missing. Output moves to it from device thread without interrupting
+    // players.
+    void set_device(const std::string &name);
+
+    // name of device output stream is opened on
+    std::string get_device(void);
+
+    // sample formats a device accepts, empty until devices are scanned
+    std::vector<OutputFormat> get_device_formats(const std::string &name);
+
+    // sample format of output stream on selected device, stream is reopened
+    // when it changes. Auto leaves conversion to host API.
+    void set_output_format(OutputFormat);
+    OutputFormat get_output_format(void);
+
+    // frames per buffer of output stream on selected device, 0 lets host
+    // API choose. Stream is reopened when it changes.
+    void set_output_buffer_frames(unsigned long);
+    unsigned long get_output_buffer_frames(void);
+
+    // buffer sizes calibration goes through, smallest first
+    static std::vector<unsigned long> get_buffer_sizes(void);
+
+    // find smallest buffer size selected device plays without dropouts
+    // under synthetic mixing load, from device thread. Only runs while no
+    // player is playing. Output buffer size is set to chosen size plus a
+    // safety margin.
+    void calibrate(void);
+    bool is_calibrating(void);
+
+    // called from device thread once calibration is over with chosen
+    // buffer size, 0 if none was stable
+    void set_calibration_callback(std::function<void(unsigned long)>);
+
+    // players opened once a file is cached play it from memory, null
+    // disables caching
+    void set_sample_cache(std::shared_ptr<SampleCache>);
+    std::shared_ptr<SampleCache> get_sample_cache(void);
 
     void set_mode(AudioMixerMode);
     std::vector<AudioMixerModePair> get_modes(void);
     AudioMixerMode get_mode(void);
 
   private:
+    friend class AudioPlayer;
+
+    // fade out duration of choked players when trigger does not specify one
+    static constexpr float CHOKE_FADE_SECONDS = 0.005;
+
+    // mix bus fade out on old device and fade in on new one when output is
+    // moved to another device
+    static constexpr float BUS_FADE_SECONDS = 0.01;
+
+    // longest wait for old stream to hand mixing over
+    static constexpr double HANDOVER_TIMEOUT_SECONDS = 1.0;
+
+    // output that did not call back for that long lost its device
+    static constexpr double OUTPUT_STALL_SECONDS = 0.5;
+
+    // time each buffer size is played during calibration, after letting
+    // stream settle
+    static constexpr double CALIBRATION_SECONDS = 2.0;
+    static constexpr double CALIBRATION_SETTLE_SECONDS = 0.3;
+    // synthetic voices mixed by stream callback during calibration
+    static const unsigned CALIBRATION_VOICES = 32;
+    // buffers mixed in more than this share of their duration are late
+    static constexpr double CALIBRATION_DEADLINE = 0.7;
+
+    // apply command from audio callback, offset frames into current buffer
+    void apply(const audio_mixer_command_t &, unsigned long offset);
+
+    // push event from audio callback, event thread is woken up once buffer
+    // is mixed
+    void post_event(AudioMixerEventType, AudioPlayerID);
+
+    // hand voice decoder of player over to event thread to be destroyed,
+    // from audio callback. Return false and keep decoder if queue is full.
+    bool retire_decoder(AudioPlayer *);
+
+    // run by event thread, calls events callback when events are waiting
+    void run_events(void);
+
+    // destroy removed players audio callback is done with
+    void release_removed_players(void);
+
+    // maximum number of commands waiting for a future buffer
+    static const size_t MAX_SCHEDULED_COMMANDS = 1024;
+    // maximum number of players rendered at once
+    static const size_t MAX_VOICES = 1024;
+    // mix bus is reserved for at least this many frames when a stream is
+    // opened, larger buffers asked by the host are played silent
+    static const unsigned long MAX_BUFFER_FRAMES = 8192;
+
+    // open and start stream of given slot
+    bool open_stream(PaDeviceIndex idx, int slot, OutputFormat format,
+      unsigned long frames_per_buffer);
+    void close_stream(int slot);
+
+    // run by device thread, which owns PortAudio initialization and streams
+    void run_devices(void);
+    // list output devices, reinitializing PortAudio first if asked to
+    void scan(bool reinitialize);
+    // move output to selected device, opening it before current stream is
+    // closed so players keep their state and output gap stays within a buffer
+    void reopen(void);
+    // true when no player is playing
+    bool is_idle(void);
+    // owner stream stopped or stalled, its device was most likely unplugged,
+    // called by device thread on each of its wake ups
+    bool is_output_lost(void);
+    // try buffer sizes from largest to smallest, run by device thread
+    void run_calibration(void);
+    // mix synthetic voices into scratch buffers, from stream callback
+    void render_calibration_load(unsigned long frames);
+
+    std::string get_device_name(PaDeviceIndex idx);
+    PaDeviceIndex get_device_by_name(const std::string &name);
+
+    // output streams, players are mixed into owner stream only, the other
+    // one is either closed or silent
+    audio_mixer_stream_t streams[2];
+    std::atomic<int> owner;
+    // owner stream fades its bus out and hands mixing over to other stream
+    std::atomic<bool> handover;
+    // held by device thread while streams are opened or closed
+    std::mutex stream_mutex;
+    std::atomic<double> samplerate_hz;
+    std::atomic<uint64_t> clock;
+
+    // frame of last mixed buffer and time it reaches the DAC, written by
+    // audio callback under a sequence lock
+    std::atomic<unsigned> dac_sequence;
+    std::atomic<uint64_t> dac_frame;
+    std::atomic<double> dac_time;
+    // duration of last mixed buffer, in frames
+    std::atomic<unsigned long> buffer_frames;
 
     // currently selected device
     std::atomic<PaDeviceIndex> current_device;
     // currently selected mode
     std::atomic<AudioMixerMode> current_mode;
-    // map of audio players
-    AudioPlayerMap players;
+    // player of handle or null, caller holds registry or players mutex
+    std::shared_ptr<AudioPlayer> const& lookup(AudioPlayerID);
+
+    // all players, indexed by handle slot
+    std::vector<audio_player_slot_t> slots;
+    // slots of removed players, ready for reuse
+    std::vector<uint16_t> free_slots;
+    // players being rendered, owned by audio callback, reserved once so it
+    // never allocates
+    ArenaVector<AudioPlayer*> voices;
+    // removed players kept alive until audio callback dropped their voice,
+    // registry mutex held
+    std::vector<std::shared_ptr<AudioPlayer>> removed_players;
+    // held while slots are modified, audio callback only tries to take it
+    // to apply commands and skips them for a buffer when it can not
+    std::mutex players_mutex;
+    // held by non audio threads reading slots and while slots are modified
+    std::recursive_mutex registry_mutex;
+
+    // commands waiting for next mixer buffer
+    CommandQueue<audio_mixer_command_t, 1024> commands;
+    // commands waiting for a future buffer, owned by audio callback
+    ArenaVector<audio_mixer_command_t> scheduled;
+
+    // events waiting for gui
+    EventQueue<audio_mixer_event_t, 1024> events;
+    // decoders released by audio callback, destroyed by event thread
+    EventQueue<Decoder*, 1024> retired;
+    // events were pushed during current buffer, owned by audio callback
+    bool events_posted;
+    // events were pushed since event thread last woke up
+    std::atomic<bool> events_pending;
+    std::function<void()> events_callback;
+    // protect events callback
+    std::mutex events_mutex;
+    std::condition_variable events_cv;
+    std::unique_ptr<std::thread> event_thread;
+    // thread will try to quit when true
+    std::atomic<bool> event_quit;
+
+    std::shared_ptr<SampleCache> sample_cache;
+    std::mutex sample_cache_mutex;
+
+    // trigger latency statistics, updated by audio callback
+    audio_mixer_latency_t trigger_latency;
+    std::mutex trigger_latency_mutex;
 
     // list of available devices 
     std::vector<std::pair<PaDeviceIndex,std::string>> devices;
-
-    // next audio player ID
-    AudioPlayerID next_audio_player_id;
+    // name of selected device
+    std::string device_name;
+    // sample formats accepted by each device
+    std::map<std::string, std::vector<OutputFormat>> device_formats;
+    // sample format asked for on selected device
+    OutputFormat output_format;
+    // frames per buffer asked for on selected device
+    unsigned long output_buffer_frames;
+    std::function<void(unsigned long)> calibration_callback;
+    std::function<void()> devices_callback;
+    // protect devices, device name, formats and callback
+    std::mutex devices_mutex;
+
+    std::unique_ptr<std::thread> device_thread;
+    // requests handled by device thread
+    std::atomic<bool> scan_requested;
+    std::atomic<bool> open_requested;
+    std::atomic<bool> calibrate_requested;
+    std::atomic<bool> calibrating;
+    // synthetic voices rendered by stream callback, 0 outside calibration
+    std::atomic<unsigned> calibration_voices;
+    // synthetic voices source and mix, allocated before voices are enabled
+    ArenaVector<float> calibration_source;
+    ArenaVector<float> calibration_mix;
+    std::atomic<bool> devices_ready;
+    // only touched by device thread
+    bool portaudio_initialized;
+    // owner stream callbacks count when it last changed, device thread only
+    unsigned watched_callbacks;
+    std::chrono::steady_clock::time_point watched_time;
+    // thread will try to quit when true
+    std::atomic<bool> device_quit;
 };
 
 #endif
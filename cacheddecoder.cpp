@@ -0,0 +1,86 @@
+#include "cacheddecoder.hpp"
+
+#include <algorithm>
+
+CachedDecoder::CachedDecoder(std::shared_ptr<const CachedSamples> samples) :
+  samples(samples),
+  auto_rewind(false),
+  start_frame(0),
+  end_frame(0),
+  position(0) {
+
+}
+
+CachedDecoder::~CachedDecoder() {
+
+}
+
+bool CachedDecoder::open(std::string filename) {
+  // samples are already decoded
+  (void)filename;
+  auto &p = get_parameters();
+  p.channels = 2;
+  p.samplerate_hz = samples->samplerate_hz;
+  p.bitrate_hz = 0;
+  p.source_channels = samples->source_channels;
+  p.layout = samples->layout;
+
+  return samples->frames > 0;
+}
+
+void CachedDecoder::start(void) {
+  rewind();
+}
+
+void CachedDecoder::join(void) {
+  return;
+}
+
+void CachedDecoder::exit(void) {
+  return;
+}
+
+void CachedDecoder::rewind(void) {
+  position = std::min(start_frame, samples->frames);
+}
+
+void CachedDecoder::set_auto_rewind(bool b) {
+  auto_rewind = b;
+}
+
+void CachedDecoder::set_range(uint64_t start, uint64_t end) {
+  start_frame = start;
+  // empty range would never produce a frame
+  end_frame = end > start ? end : 0;
+}
+
+unsigned CachedDecoder::pop_frames(float *left, float *right, unsigned n) {
+  uint64_t end = samples->frames;
+  if(end_frame > 0)
+    end = std::min(end, end_frame);
+
+  unsigned done = 0;
+  while(done < n) {
+    if(position >= end) {
+      // nothing left in range, stop instead of rewinding forever
+      if(!auto_rewind || std::min(start_frame, end) >= end)
+        break;
+      rewind();
+      loops++;
+    }
+
+    unsigned m = std::min<uint64_t>(n - done, end - position);
+    samples->expand(position, m, left + done, right + done);
+    position += m;
+    done += m;
+  }
+
+  return done;
+}
+
+unsigned CachedDecoder::try_pop_frames(float *left, float *right, unsigned n, bool &end) {
+  // every frame is available at once
+  unsigned got = pop_frames(left, right, n);
+  end = got < n;
+  return got;
+}
@@ -0,0 +1,48 @@
+#ifndef _CACHEDDECODER_HPP
+#define _CACHEDDECODER_HPP
+
+#include "decoder.hpp"
+#include "samplecache.hpp"
+
+#include <atomic>
+#include <memory>
+
+// plays samples of a file cached in memory, nothing is read from disk and
+// pop_frames never blocks
+class CachedDecoder : public Decoder {
+
+  public:
+    explicit CachedDecoder(std::shared_ptr<const CachedSamples> samples);
+    virtual ~CachedDecoder();
+
+    bool open(std::string filename);
+
+    void start(void);
+
+    void join(void);
+
+    void exit(void);
+
+    void rewind(void);
+
+    void set_auto_rewind(bool);
+
+    void set_range(uint64_t start, uint64_t end);
+
+    unsigned pop_frames(float *left, float *right, unsigned n);
+
+    unsigned try_pop_frames(float *left, float *right, unsigned n, bool &end);
+
+  private:
+
+    std::shared_ptr<const CachedSamples> samples;
+
+    std::atomic<bool> auto_rewind;
+
+    // decoded range and current read position, in frames
+    uint64_t start_frame;
+    uint64_t end_frame;
+    uint64_t position;
+};
+
+#endif//_CACHEDDECODER_HPP
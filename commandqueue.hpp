@@ -0,0 +1,67 @@
+#ifndef _COMMANDQUEUE_HPP
+#define _COMMANDQUEUE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+
+// bounded ring buffer carrying commands to a single consumer (the audio
+// callback), consumer side never blocks nor allocates. Producers are
+// serialized among themselves so a batch of commands is published at once
+// and is seen entirely, or not at all, by the consumer.
+template<typename T, size_t N>
+class CommandQueue {
+
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+  public:
+    CommandQueue()
+      :head(0),
+      tail(0) {
+    }
+
+    // push n commands as one batch, return false if queue is too full
+    bool push(const T *items, size_t n) {
+      std::unique_lock<std::mutex> mlock(producers_mutex);
+
+      size_t t = tail.load(std::memory_order_relaxed);
+      size_t h = head.load(std::memory_order_acquire);
+      if(N - (t - h) < n)
+        return false;
+
+      for(size_t i=0; i<n; i++)
+        buffer[(t + i) & (N - 1)] = items[i];
+
+      // publish whole batch
+      tail.store(t + n, std::memory_order_release);
+      return true;
+    }
+
+    bool push(const T &item) {
+      return push(&item, 1);
+    }
+
+    // pop oldest command, return false if queue is empty
+    bool pop(T &item) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if(h == tail.load(std::memory_order_acquire))
+        return false;
+
+      item = buffer[h & (N - 1)];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+
+    T buffer[N];
+
+    // next slot to pop, only written by consumer
+    std::atomic<size_t> head;
+    // next slot to push, only written by producers
+    std::atomic<size_t> tail;
+
+    std::mutex producers_mutex;
+};
+
+#endif//_COMMANDQUEUE_HPP
@@ -0,0 +1,298 @@
+#include "configstore.hpp"
+#include "atomicfile.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+constexpr double ConfigStore::SETTLE_SECONDS;
+constexpr double ConfigStore::MAX_DELAY_SECONDS;
+
+const uint32_t SESSION_MAGIC = 0x53534253; // "SBSS"
+const uint32_t SESSION_VERSION = 1;
+
+static std::string unescape_name(const std::string &name) {
+  std::string r;
+  for(size_t i=0; i<name.size(); i++) {
+    if(name[i] == '\\' && i+1 < name.size())
+      i++;
+    r += name[i];
+  }
+  return r;
+}
+
+static std::string unescape_value(const std::string &value) {
+  size_t from = 0, to = value.size();
+  if(to >= 2 && value.front() == '"' && value.back() == '"') {
+    from++;
+    to--;
+  }
+
+  std::string r;
+  for(size_t i=from; i<to; i++) {
+    char c = value[i];
+    if(c == '\\' && i+1 < to) {
+      c = value[++i];
+      switch(c) {
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        default: break;
+      }
+    }
+    r += c;
+  }
+  return r;
+}
+
+static std::string trim(const std::string &s) {
+  size_t from = 0, to = s.size();
+  while(from < to && std::isspace((unsigned char)s[from]))
+    from++;
+  while(to > from && std::isspace((unsigned char)s[to-1]))
+    to--;
+  return s.substr(from, to - from);
+}
+
+ConfigStore::ConfigStore(const std::string &path, const std::string &import_path)
+  :path(path),
+  revision(0),
+  saved_revision(0),
+  quit(false) {
+
+  if(!load() && !import_path.empty() && import(import_path)) {
+    // imported entries are written to session file right away
+    first_change = last_change = clock::now();
+    revision++;
+  }
+  flush_thread = std::thread(&ConfigStore::run, this);
+}
+
+ConfigStore::~ConfigStore() {
+  {
+    std::unique_lock<std::mutex> lock(entries_mutex);
+    quit = true;
+  }
+  changed_cv.notify_all();
+  flush_thread.join();
+
+  flush();
+}
+
+bool ConfigStore::read(const std::string &key, std::string &value) {
+  std::unique_lock<std::mutex> lock(entries_mutex);
+  auto it = entries.find(key);
+  if(it == entries.end())
+    return false;
+  value = it->second;
+  return true;
+}
+
+std::vector<std::string> ConfigStore::read_all(const std::string &suffix) {
+  std::unique_lock<std::mutex> lock(entries_mutex);
+  std::vector<std::string> values;
+  for(auto const& item: entries) {
+    auto const& key = item.first;
+    if(key.size() >= suffix.size()
+      && key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0)
+      values.push_back(item.second);
+  }
+  return values;
+}
+
+void ConfigStore::write(const std::string &key, const std::string &value) {
+  {
+    std::unique_lock<std::mutex> lock(entries_mutex);
+    auto it = entries.find(key);
+    if(it != entries.end() && it->second == value)
+      return;
+    entries[key] = value;
+
+    auto now = clock::now();
+    if(revision == saved_revision)
+      first_change = now;
+    last_change = now;
+    revision++;
+  }
+  changed_cv.notify_all();
+}
+
+bool ConfigStore::flush(void) {
+  std::unique_lock<std::mutex> flock(file_mutex);
+
+  std::map<std::string, std::string> snapshot;
+  uint64_t snapshot_revision;
+  {
+    std::unique_lock<std::mutex> lock(entries_mutex);
+    if(revision == saved_revision)
+      return true;
+    snapshot = entries;
+    snapshot_revision = revision;
+  }
+
+  bool ok = save(snapshot);
+
+  std::unique_lock<std::mutex> lock(entries_mutex);
+  if(ok) {
+    saved_revision = snapshot_revision;
+  }
+  else {
+    // try again later instead of spinning on a failing disk
+    first_change = last_change = clock::now();
+  }
+  return ok;
+}
+
+bool ConfigStore::load(void) {
+  // whole file in one read
+  std::ifstream ifile(path, std::ios::binary | std::ios::ate);
+  if(!ifile)
+    return false;
+  std::streamoff size = ifile.tellg();
+  if(size < 0)
+    return false;
+  std::string data(size, '\0');
+  ifile.seekg(0);
+  ifile.read(&data[0], size);
+  if(!ifile)
+    return false;
+
+  size_t offset = 0;
+  auto get_u32 = [&](uint32_t &v) {
+    if(data.size() - offset < sizeof(v))
+      return false;
+    memcpy(&v, data.data() + offset, sizeof(v));
+    offset += sizeof(v);
+    return true;
+  };
+
+  uint32_t magic, version, count;
+  if(!get_u32(magic) || !get_u32(version) || !get_u32(count)
+    || magic != SESSION_MAGIC || version != SESSION_VERSION) {
+    std::cerr<<"invalid session file "<<path<<"\n";
+    return false;
+  }
+
+  std::map<std::string, std::string> _entries;
+  for(uint32_t i=0; i<count; i++) {
+    uint32_t nkey, nvalue;
+    if(!get_u32(nkey) || !get_u32(nvalue)
+      || data.size() - offset < (uint64_t)nkey + nvalue) {
+      std::cerr<<"truncated session file "<<path<<"\n";
+      return false;
+    }
+    std::string key = data.substr(offset, nkey);
+    offset += nkey;
+    _entries[key] = data.substr(offset, nvalue);
+    offset += nvalue;
+  }
+
+  entries = std::move(_entries);
+  return true;
+}
+
+bool ConfigStore::import(const std::string &import_path) {
+  std::ifstream ifile(import_path);
+  if(!ifile)
+    return false;
+
+  std::string line;
+  bool in_group = false;
+  while(std::getline(ifile, line)) {
+    line = trim(line);
+    if(line.empty() || line[0] == ';' || line[0] == '#')
+      continue;
+    // only root entries are used
+    if(line[0] == '[') {
+      in_group = true;
+      continue;
+    }
+    if(in_group)
+      continue;
+
+    // first unescaped '=' separates name from value
+    size_t eq = std::string::npos;
+    for(size_t i=0; i<line.size(); i++) {
+      if(line[i] == '\\')
+        i++;
+      else if(line[i] == '=') {
+        eq = i;
+        break;
+      }
+    }
+    if(eq == std::string::npos)
+      continue;
+
+    auto name = unescape_name(trim(line.substr(0, eq)));
+    entries[name] = unescape_value(trim(line.substr(eq + 1)));
+  }
+
+  return true;
+}
+
+bool ConfigStore::save(const std::map<std::string, std::string> &snapshot) {
+  std::string data;
+  auto put_u32 = [&](uint32_t v) {
+    data.append((const char*)&v, sizeof(v));
+  };
+  put_u32(SESSION_MAGIC);
+  put_u32(SESSION_VERSION);
+  put_u32(snapshot.size());
+  for(auto const& item: snapshot) {
+    put_u32(item.first.size());
+    put_u32(item.second.size());
+    data += item.first;
+    data += item.second;
+  }
+
+  // write aside and move over session so a crash never leaves a partial
+  // file, nor no file at all
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream ofile(tmp_path, std::ios::binary | std::ios::trunc);
+    if(!ofile) {
+      std::cerr<<"unable to write session "<<tmp_path<<"\n";
+      return false;
+    }
+
+    ofile.write(data.data(), data.size());
+    ofile.flush();
+    if(!ofile) {
+      std::cerr<<"unable to write session "<<tmp_path<<"\n";
+      return false;
+    }
+  }
+
+  if(!atomic_replace(tmp_path, path)) {
+    std::cerr<<"unable to replace session "<<path<<"\n";
+    return false;
+  }
+  return true;
+}
+
+void ConfigStore::run(void) {
+  std::unique_lock<std::mutex> lock(entries_mutex);
+  while(!quit) {
+    if(revision == saved_revision) {
+      changed_cv.wait(lock);
+      continue;
+    }
+
+    auto settle = last_change
+      + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(SETTLE_SECONDS));
+    auto limit = first_change
+      + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(MAX_DELAY_SECONDS));
+    auto deadline = std::min(settle, limit);
+    if(clock::now() < deadline) {
+      changed_cv.wait_until(lock, deadline);
+      continue;
+    }
+
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
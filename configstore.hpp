@@ -0,0 +1,83 @@
+#ifndef _CONFIGSTORE_HPP
+#define _CONFIGSTORE_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+// key/value session kept in memory. Changes are written back by a
+// background thread once they settle, the whole file is written aside and
+// renamed over the previous one. Pending changes are written on destruction.
+//
+// Session file is binary and read at once, values may hold any bytes:
+//   uint32 magic, uint32 version, uint32 count
+//   count times: uint32 key size, uint32 value size, key, value
+class ConfigStore {
+
+  public:
+    // when session file does not exist yet, entries are imported from
+    // wxFileConfig file import_path (root entries only), if any
+    explicit ConfigStore(const std::string &path,
+      const std::string &import_path = std::string());
+    ~ConfigStore();
+
+    // return false if key is not set
+    bool read(const std::string &key, std::string &value);
+
+    // values of all keys ending with suffix, in key order
+    std::vector<std::string> read_all(const std::string &suffix);
+
+    void write(const std::string &key, const std::string &value);
+
+    // write pending changes now, return false on error
+    bool flush(void);
+
+    // changes are written once no other change came for this long
+    static constexpr double SETTLE_SECONDS = 0.5;
+    // but never later than this after first pending change
+    static constexpr double MAX_DELAY_SECONDS = 2.0;
+
+  private:
+
+    using clock = std::chrono::steady_clock;
+
+    bool load(void);
+
+    // read entries of a wxFileConfig file
+    bool import(const std::string &import_path);
+
+    bool save(const std::map<std::string, std::string> &snapshot);
+
+    void run(void);
+
+    std::string path;
+
+    std::map<std::string, std::string> entries;
+
+    // bumped on each change, file holds entries of saved revision
+    uint64_t revision;
+    uint64_t saved_revision;
+
+    // time of first and last change not saved yet
+    clock::time_point first_change;
+    clock::time_point last_change;
+
+    // guards entries, revisions and change times
+    std::mutex entries_mutex;
+    std::condition_variable changed_cv;
+
+    // held while file is written, so older snapshots never overwrite newer
+    std::mutex file_mutex;
+
+    std::thread flush_thread;
+
+    // thread will quit when true
+    bool quit;
+};
+
+#endif//_CONFIGSTORE_HPP
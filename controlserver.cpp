@@ -0,0 +1,222 @@
+#include "controlserver.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+ControlServer::ControlServer(std::shared_ptr<AudioMixer> mixer)
+  :mixer(mixer),
+  quit(false) {
+}
+
+ControlServer::~ControlServer() {
+  exit();
+  join();
+
+#ifndef _WIN32
+  for(auto fd: fds)
+    ::close(fd);
+  if(!unix_path.empty())
+    unlink(unix_path.c_str());
+#endif
+}
+
+bool ControlServer::open_unix(const std::string &path) {
+#ifndef _WIN32
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr.sun_path)) {
+    std::cerr<<"control socket path too long "<<path<<"\n";
+    return false;
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if(fd < 0) {
+    std::cerr<<"control socket error "<<strerror(errno)<<"\n";
+    return false;
+  }
+
+  // remove stale socket left by a previous instance
+  unlink(path.c_str());
+
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    std::cerr<<"control socket bind error "<<strerror(errno)<<"\n";
+    ::close(fd);
+    return false;
+  }
+
+  unix_path = path;
+  fds.push_back(fd);
+  return true;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+bool ControlServer::open_udp(int port) {
+#ifndef _WIN32
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  // never listen beyond this machine
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if(fd < 0) {
+    std::cerr<<"control udp error "<<strerror(errno)<<"\n";
+    return false;
+  }
+
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    std::cerr<<"control udp bind error "<<strerror(errno)<<"\n";
+    ::close(fd);
+    return false;
+  }
+
+  fds.push_back(fd);
+  return true;
+#else
+  (void)port;
+  return false;
+#endif
+}
+
+void ControlServer::start(void) {
+  if(fds.empty() || server_thread)
+    return;
+  server_thread = std::make_unique<std::thread>(&ControlServer::run, this);
+}
+
+void ControlServer::exit(void) {
+  quit = true;
+}
+
+void ControlServer::join(void) {
+  if(server_thread) {
+    server_thread->join();
+    server_thread.reset();
+  }
+}
+
+void ControlServer::run(void) {
+#ifndef _WIN32
+  std::vector<struct pollfd> pfds;
+  for(auto fd: fds)
+    pfds.push_back({fd, POLLIN, 0});
+
+  unsigned char buffer[65536];
+  while(!quit) {
+    // wake up regularly to check quit
+    int n = poll(pfds.data(), pfds.size(), 100);
+    if(n <= 0)
+      continue;
+
+    for(auto const& pfd: pfds) {
+      if(!(pfd.revents & POLLIN))
+        continue;
+      struct sockaddr_storage from;
+      socklen_t fromlen = sizeof(from);
+      auto rsize = recvfrom(pfd.fd, buffer, sizeof(buffer), 0,
+        (struct sockaddr*)&from, &fromlen);
+      if(rsize <= 0)
+        continue;
+
+      control_reply_t reply;
+      if(dispatch(buffer, rsize, reply))
+        continue;
+
+      // unbound UNIX sockets have no address to answer to, never wait on
+      // a client that does not read its replies
+      if(fromlen > sizeof(sa_family_t))
+        sendto(pfd.fd, &reply, sizeof(reply), MSG_DONTWAIT,
+          (struct sockaddr*)&from, fromlen);
+    }
+  }
+#endif
+}
+
+bool ControlServer::dispatch(const unsigned char *data, size_t size, control_reply_t &reply) {
+  reply.magic = CONTROL_PACKET_MAGIC;
+  reply.version = CONTROL_PACKET_VERSION;
+  reply.error = CONTROL_ERROR_PACKET;
+  reply.index = 0;
+
+  control_packet_header_t header;
+  if(size < sizeof(header)) {
+    std::cerr<<"invalid control packet\n";
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+
+  if(header.magic != CONTROL_PACKET_MAGIC
+    || header.version != CONTROL_PACKET_VERSION
+    || size < sizeof(header) + header.count*sizeof(control_command_t)) {
+    std::cerr<<"invalid control packet\n";
+    return false;
+  }
+
+  std::vector<control_command_t> commands(header.count);
+  memcpy(commands.data(), data + sizeof(header), header.count*sizeof(control_command_t));
+
+  // whole batch is rejected so it never applies in part
+  for(unsigned i=0; i<header.count; i++) {
+    if(!std::isfinite(commands[i].value)) {
+      std::cerr<<"invalid control value in command "<<i<<"\n";
+      reply.error = CONTROL_ERROR_VALUE;
+      reply.index = i;
+      return false;
+    }
+  }
+
+  AudioMixerCommands batch;
+  for(auto const& command: commands) {
+    auto id = mixer->get_player_at(command.x, command.y);
+    if(id == 0)
+      continue;
+
+    float fade_seconds = (command.flags & CONTROL_FLAG_FADE)
+      ? std::min(CONTROL_MAX_FADE_S, std::max(0.0f, command.value)) : -1;
+
+    switch(command.op) {
+
+      case CONTROL_OP_TRIGGER:
+        mixer->collect_trigger(id, fade_seconds, batch);
+        break;
+
+      case CONTROL_OP_STOP:
+        mixer->collect_stop(id, fade_seconds, batch);
+        break;
+
+      case CONTROL_OP_GAIN:
+        batch.push_back({MIXER_COMMAND_GAIN, id,
+          std::min(2.0f, std::max(0.0f, command.value)), 0});
+        break;
+
+      case CONTROL_OP_MUTE:
+        batch.push_back({MIXER_COMMAND_MUTE, id, command.value, 0});
+        break;
+
+      default:
+        std::cerr<<"unknown control operation "<<(int)command.op<<"\n";
+        break;
+    }
+  }
+
+  mixer->post(batch);
+  return true;
+}
@@ -0,0 +1,120 @@
+#ifndef _CONTROLSERVER_HPP
+#define _CONTROLSERVER_HPP
+
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "audiomixer.hpp"
+
+// Binary control protocol, one datagram per batch, host byte order.
+//
+// A datagram is a control_packet_header_t followed by count commands.
+// All commands of a datagram take effect on the same mixer buffer.
+// Pads are addressed by their grid position as in the configuration keys
+// (player#x#y#...).
+//
+// A datagram that is rejected as a whole is answered with a
+// control_reply_t sent back to its source, when the source has an address.
+
+const uint32_t CONTROL_PACKET_MAGIC = 0x31434253; // "SBC1"
+const uint16_t CONTROL_PACKET_VERSION = 1;
+
+enum ControlOperation {
+  // start pad and its trigger group
+  CONTROL_OP_TRIGGER = 1,
+  // fade out and release pad
+  CONTROL_OP_STOP,
+  // set pad gain to value (0.0 to 2.0)
+  CONTROL_OP_GAIN,
+  // mute pad when value is not zero
+  CONTROL_OP_MUTE,
+};
+
+// use command value as fade duration in seconds for trigger and stop,
+// pad own fade durations are used otherwise
+const uint8_t CONTROL_FLAG_FADE = 0x01;
+
+// longer fades are shortened to this duration, in seconds
+const float CONTROL_MAX_FADE_S = 60.0;
+
+enum ControlError {
+  // header is invalid or datagram is shorter than its commands
+  CONTROL_ERROR_PACKET = 1,
+  // a command value is not a finite number
+  CONTROL_ERROR_VALUE,
+};
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+} control_packet_header_t;
+
+typedef struct {
+  uint8_t op;
+  uint8_t x;
+  uint8_t y;
+  uint8_t flags;
+  float value;
+} control_command_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  // ControlError
+  uint16_t error;
+  // index of offending command in datagram, 0 for packet errors
+  uint32_t index;
+} control_reply_t;
+
+static_assert(sizeof(control_packet_header_t) == 8, "unexpected header layout");
+static_assert(sizeof(control_command_t) == 8, "unexpected command layout");
+static_assert(sizeof(control_reply_t) == 12, "unexpected reply layout");
+
+// receive control datagrams on local sockets and post them straight to the
+// mixer command queue, without going through the gui event loop
+class ControlServer {
+
+  public:
+    explicit ControlServer(std::shared_ptr<AudioMixer> mixer);
+    ~ControlServer();
+
+    // listen on a UNIX domain datagram socket
+    bool open_unix(const std::string &path);
+
+    // listen on a localhost UDP port
+    bool open_udp(int port);
+
+    void start(void);
+
+    void exit(void);
+
+    void join(void);
+
+  private:
+
+    void run(void);
+
+    // decode datagram and post its commands as one batch, return false and
+    // fill reply if datagram is rejected, nothing is posted then
+    bool dispatch(const unsigned char *data, size_t size, control_reply_t &reply);
+
+    std::shared_ptr<AudioMixer> mixer;
+
+    // listening sockets
+    std::vector<int> fds;
+
+    // path of UNIX socket, removed on exit
+    std::string unix_path;
+
+    std::unique_ptr<std::thread> server_thread;
+
+    // thread will try to quit when true
+    std::atomic<bool> quit;
+};
+
+#endif//_CONTROLSERVER_HPP
@@ -0,0 +1,14 @@
+#include "decoder.hpp"
+#include "maddecoder.hpp"
+#include "wavdecoder.hpp"
+
+std::unique_ptr<Decoder> Decoder::create(const std::string &filename) {
+  // extract extension from filename
+  auto ext = filename.substr( filename.find_last_of(".") +  1);
+
+  if(ext == "mp3")
+    return std::make_unique<MADDecoder>();
+  else if(ext == "wav")
+    return std::make_unique<WAVDecoder>();
+  return nullptr;
+}
@@ -3,6 +3,22 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+
+// speaker layout of a file, decoders always output stereo
+enum ChannelLayout {
+  CHANNEL_LAYOUT_UNKNOWN = 0,
+  CHANNEL_LAYOUT_MONO,
+  CHANNEL_LAYOUT_STEREO,
+  CHANNEL_LAYOUT_3_0,
+  CHANNEL_LAYOUT_QUAD,
+  CHANNEL_LAYOUT_5_0,
+  CHANNEL_LAYOUT_5_1,
+  CHANNEL_LAYOUT_6_1,
+  CHANNEL_LAYOUT_7_1,
+};
 
 typedef struct {
 
@@ -10,26 +26,33 @@ typedef struct {
   int bitrate_hz;
   int samplerate_hz;
 
-} audio_parameters_t;
+  // channels stored in file and their layout, mixed down to channels
+  int source_channels;
+  ChannelLayout layout;
 
-typedef struct {
-  float left;
-  float right;
-} audio_frame_t;
+} audio_parameters_t;
 
 class Decoder {
 
   public:
-    Decoder() {
+    Decoder()
+      :loops(0),
+      errors(0),
+      underruns(0) {
           
       parameters.channels = -1;
       parameters.bitrate_hz = -1;
       parameters.samplerate_hz = -1;
+      parameters.source_channels = -1;
+      parameters.layout = CHANNEL_LAYOUT_UNKNOWN;
     }
 
     virtual ~Decoder() {
     }
 
+    // decoder matching file extension, null if format is not supported
+    static std::unique_ptr<Decoder> create(const std::string &filename);
+
     audio_parameters_t& get_parameters(void) {
       return parameters;
     }
@@ -46,7 +69,37 @@ class Decoder {
 
     virtual void set_auto_rewind(bool) = 0;
 
-    virtual std::vector<audio_frame_t> pop_frames(unsigned int n) = 0;
+    // only decode frames [start, end) of file, end 0 meaning end of file,
+    // rewinding goes back to start. Frames before start are skipped without
+    // being decoded. Must be called before start().
+    virtual void set_range(uint64_t start, uint64_t end) = 0;
+
+    // pop at most n frames into planar channel buffers, return number of
+    // frames popped, 0 once end of stream is reached
+    virtual unsigned pop_frames(float *left, float *right, unsigned n) = 0;
+
+    // pop at most n frames already decoded, never waits. Fewer frames than
+    // asked for means decoder fell behind, unless end is set because end of
+    // stream was reached.
+    virtual unsigned try_pop_frames(float *left, float *right, unsigned n, bool &end) = 0;
+
+    // frames consumer pops for each output buffer, decoders running ahead
+    // of consumer size their queue after it
+    virtual void set_block_frames(unsigned) {
+    }
+
+    // times decoder rewound at end of file or range
+    unsigned get_loops(void) { return loops; }
+    // undecodable data met since open
+    unsigned get_errors(void) { return errors; }
+    // times try_pop_frames came short of frames not decoded yet
+    unsigned get_underruns(void) { return underruns; }
+
+  protected:
+
+    std::atomic<unsigned> loops;
+    std::atomic<unsigned> errors;
+    std::atomic<unsigned> underruns;
 
   private:
     
@@ -0,0 +1,181 @@
+#include "downmix.hpp"
+
+#include "sndfile.h"
+
+#include <mutex>
+#include <cmath>
+
+static std::mutex levels_mutex;
+static downmix_levels_t levels = downmix_default_levels();
+
+downmix_levels_t downmix_default_levels(void) {
+  downmix_levels_t l;
+  l.center = std::sqrt(0.5f);
+  l.surround = std::sqrt(0.5f);
+  l.lfe = 0.0f;
+  return l;
+}
+
+void downmix_set_levels(const downmix_levels_t &l) {
+  std::unique_lock<std::mutex> mlock(levels_mutex);
+  levels = l;
+}
+
+downmix_levels_t downmix_get_levels(void) {
+  std::unique_lock<std::mutex> mlock(levels_mutex);
+  return levels;
+}
+
+ChannelLayout downmix_default_layout(int channels) {
+  switch(channels) {
+    case 1: return CHANNEL_LAYOUT_MONO;
+    case 2: return CHANNEL_LAYOUT_STEREO;
+    case 3: return CHANNEL_LAYOUT_3_0;
+    case 4: return CHANNEL_LAYOUT_QUAD;
+    case 5: return CHANNEL_LAYOUT_5_0;
+    case 6: return CHANNEL_LAYOUT_5_1;
+    case 7: return CHANNEL_LAYOUT_6_1;
+    case 8: return CHANNEL_LAYOUT_7_1;
+    default: return CHANNEL_LAYOUT_UNKNOWN;
+  }
+}
+
+// default WAVE channel order of each layout
+static std::vector<int> default_positions(int channels) {
+  const int L = SF_CHANNEL_MAP_FRONT_LEFT;
+  const int R = SF_CHANNEL_MAP_FRONT_RIGHT;
+  const int C = SF_CHANNEL_MAP_FRONT_CENTER;
+  const int LFE = SF_CHANNEL_MAP_LFE;
+  const int BL = SF_CHANNEL_MAP_REAR_LEFT;
+  const int BR = SF_CHANNEL_MAP_REAR_RIGHT;
+  const int BC = SF_CHANNEL_MAP_REAR_CENTER;
+  const int SL = SF_CHANNEL_MAP_SIDE_LEFT;
+  const int SR = SF_CHANNEL_MAP_SIDE_RIGHT;
+
+  switch(downmix_default_layout(channels)) {
+    case CHANNEL_LAYOUT_MONO: return {SF_CHANNEL_MAP_MONO};
+    case CHANNEL_LAYOUT_STEREO: return {L, R};
+    case CHANNEL_LAYOUT_3_0: return {L, R, C};
+    case CHANNEL_LAYOUT_QUAD: return {L, R, BL, BR};
+    case CHANNEL_LAYOUT_5_0: return {L, R, C, BL, BR};
+    case CHANNEL_LAYOUT_5_1: return {L, R, C, LFE, BL, BR};
+    case CHANNEL_LAYOUT_6_1: return {L, R, C, LFE, BC, SL, SR};
+    case CHANNEL_LAYOUT_7_1: return {L, R, C, LFE, BL, BR, SL, SR};
+    default: break;
+  }
+
+  // unknown layout, keep first two channels as before
+  std::vector<int> p(channels, SF_CHANNEL_MAP_INVALID);
+  p[0] = L;
+  p[1] = R;
+  return p;
+}
+
+bool downmix_matrix(int channels, const std::vector<int> &_positions,
+  std::vector<float> &gains_left, std::vector<float> &gains_right) {
+
+  auto positions = _positions.empty() ? default_positions(channels) : _positions;
+  if((int)positions.size() != channels)
+    return false;
+
+  auto l = downmix_get_levels();
+  gains_left.assign(channels, 0.0f);
+  gains_right.assign(channels, 0.0f);
+
+  for(int c=0; c<channels; c++) {
+    float &gl = gains_left[c];
+    float &gr = gains_right[c];
+    switch(positions[c]) {
+      case SF_CHANNEL_MAP_MONO:
+        gl = gr = 1.0f;
+        break;
+      case SF_CHANNEL_MAP_LEFT:
+      case SF_CHANNEL_MAP_FRONT_LEFT:
+      case SF_CHANNEL_MAP_FRONT_LEFT_OF_CENTER:
+        gl = 1.0f;
+        break;
+      case SF_CHANNEL_MAP_RIGHT:
+      case SF_CHANNEL_MAP_FRONT_RIGHT:
+      case SF_CHANNEL_MAP_FRONT_RIGHT_OF_CENTER:
+        gr = 1.0f;
+        break;
+      case SF_CHANNEL_MAP_CENTER:
+      case SF_CHANNEL_MAP_FRONT_CENTER:
+        gl = gr = l.center;
+        break;
+      case SF_CHANNEL_MAP_REAR_LEFT:
+      case SF_CHANNEL_MAP_SIDE_LEFT:
+        gl = l.surround;
+        break;
+      case SF_CHANNEL_MAP_REAR_RIGHT:
+      case SF_CHANNEL_MAP_SIDE_RIGHT:
+        gr = l.surround;
+        break;
+      case SF_CHANNEL_MAP_REAR_CENTER:
+        // single surround is split across both sides
+        gl = gr = l.surround*std::sqrt(0.5f);
+        break;
+      case SF_CHANNEL_MAP_LFE:
+        gl = gr = l.lfe;
+        break;
+      case SF_CHANNEL_MAP_INVALID:
+        // dropped
+        break;
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+// channel count is known at compile time so compiler vectorizes across
+// frames, gains are copied locally so they are not reloaded
+template<int N>
+static void downmix_block(const float *in,
+  const float *gains_left, const float *gains_right,
+  float *__restrict left, float *__restrict right, unsigned n) {
+
+  float gl[N], gr[N];
+  for(int c=0; c<N; c++) {
+    gl[c] = gains_left[c];
+    gr[c] = gains_right[c];
+  }
+
+  for(unsigned i=0; i<n; i++) {
+    float l = 0.0f, r = 0.0f;
+    for(int c=0; c<N; c++) {
+      l += in[i*N + c]*gl[c];
+      r += in[i*N + c]*gr[c];
+    }
+    left[i] = l;
+    right[i] = r;
+  }
+}
+
+void downmix(const float *in, int channels,
+  const float *gains_left, const float *gains_right,
+  float *left, float *right, unsigned n) {
+
+  switch(channels) {
+    case 1: downmix_block<1>(in, gains_left, gains_right, left, right, n); return;
+    case 2: downmix_block<2>(in, gains_left, gains_right, left, right, n); return;
+    case 3: downmix_block<3>(in, gains_left, gains_right, left, right, n); return;
+    case 4: downmix_block<4>(in, gains_left, gains_right, left, right, n); return;
+    case 5: downmix_block<5>(in, gains_left, gains_right, left, right, n); return;
+    case 6: downmix_block<6>(in, gains_left, gains_right, left, right, n); return;
+    case 7: downmix_block<7>(in, gains_left, gains_right, left, right, n); return;
+    case 8: downmix_block<8>(in, gains_left, gains_right, left, right, n); return;
+    default: break;
+  }
+
+  for(unsigned i=0; i<n; i++) {
+    float l = 0.0f, r = 0.0f;
+    for(int c=0; c<channels; c++) {
+      l += in[i*channels + c]*gains_left[c];
+      r += in[i*channels + c]*gains_right[c];
+    }
+    left[i] = l;
+    right[i] = r;
+  }
+}
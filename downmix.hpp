@@ -0,0 +1,39 @@
+#ifndef _DOWNMIX_HPP
+#define _DOWNMIX_HPP
+
+#include <vector>
+
+#include "decoder.hpp"
+
+// level of each group of speakers in stereo output, front left and right
+// always go to their side at unity, mono goes to both sides at unity
+typedef struct {
+
+  float center;
+  float surround;
+  float lfe;
+
+} downmix_levels_t;
+
+// ITU-R BS.775 levels, -3 dB for center and surround, LFE dropped
+downmix_levels_t downmix_default_levels(void);
+
+// levels used by decoders opened from now on
+void downmix_set_levels(const downmix_levels_t &levels);
+downmix_levels_t downmix_get_levels(void);
+
+// layout of a file from its number of channels, channels in WAVE order
+ChannelLayout downmix_default_layout(int channels);
+
+// per channel gains to left and right outputs. Positions are libsndfile
+// SF_CHANNEL_MAP_* values in file order, an empty list means WAVE order for
+// given number of channels. Return false if a position is not supported.
+bool downmix_matrix(int channels, const std::vector<int> &positions,
+  std::vector<float> &gains_left, std::vector<float> &gains_right);
+
+// mix n interleaved frames of given number of channels into planar stereo
+void downmix(const float *in, int channels,
+  const float *gains_left, const float *gains_right,
+  float *left, float *right, unsigned n);
+
+#endif//_DOWNMIX_HPP
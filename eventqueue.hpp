@@ -0,0 +1,58 @@
+#ifndef _EVENTQUEUE_HPP
+#define _EVENTQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+
+// bounded ring buffer carrying events from a single producer (the audio
+// callback) to a single consumer, neither side blocks nor allocates. Events
+// pushed while queue is full are dropped.
+template<typename T, size_t N>
+class EventQueue {
+
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+  public:
+    EventQueue()
+      :head(0),
+      tail(0) {
+    }
+
+    // push event, return false if queue is full
+    bool push(const T &item) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if(t - head.load(std::memory_order_acquire) == N)
+        return false;
+
+      buffer[t & (N - 1)] = item;
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    // next push would fail, only meaningful to producer
+    bool is_full(void) {
+      return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == N;
+    }
+
+    // pop oldest event, return false if queue is empty
+    bool pop(T &item) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if(h == tail.load(std::memory_order_acquire))
+        return false;
+
+      item = buffer[h & (N - 1)];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+
+    T buffer[N];
+
+    // next slot to pop, only written by consumer
+    std::atomic<size_t> head;
+    // next slot to push, only written by producer
+    std::atomic<size_t> tail;
+};
+
+#endif//_EVENTQUEUE_HPP
@@ -0,0 +1,104 @@
+#include "fileprefetcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+const size_t FilePrefetcher::CHUNK_BYTES;
+
+FilePrefetcher::FilePrefetcher(size_t max_bytes, double bytes_per_second)
+  :max_bytes(max_bytes),
+  bytes_per_second(bytes_per_second),
+  done(0),
+  batch(0),
+  quit(false) {
+
+  prefetch_thread = std::thread(&FilePrefetcher::run, this);
+}
+
+FilePrefetcher::~FilePrefetcher() {
+  {
+    std::unique_lock<std::mutex> lock(files_mutex);
+    quit = true;
+  }
+  files_cv.notify_all();
+  prefetch_thread.join();
+}
+
+void FilePrefetcher::prefetch(const std::vector<std::string> &filenames) {
+  {
+    std::unique_lock<std::mutex> lock(files_mutex);
+    files = filenames;
+    done = 0;
+    batch++;
+  }
+  files_cv.notify_all();
+}
+
+void FilePrefetcher::get_progress(size_t &_done, size_t &total) {
+  std::unique_lock<std::mutex> lock(files_mutex);
+  _done = done;
+  total = files.size();
+}
+
+void FilePrefetcher::run(void) {
+  std::unique_lock<std::mutex> lock(files_mutex);
+  while(!quit) {
+    if(done >= files.size()) {
+      files_cv.wait(lock);
+      continue;
+    }
+
+    auto filename = files[done];
+    unsigned b = batch;
+    lock.unlock();
+    bool complete = prefetch_file(filename, b);
+    lock.lock();
+
+    // batch may have been replaced meanwhile
+    if(complete && b == batch)
+      done++;
+  }
+}
+
+bool FilePrefetcher::prefetch_file(const std::string &filename, unsigned b) {
+#ifdef __linux__
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return true;
+
+  struct stat st;
+  size_t size = 0;
+  if(fstat(fd, &st) == 0 && st.st_size > 0)
+    size = std::min<size_t>(st.st_size, max_bytes);
+
+  bool complete = true;
+  for(size_t offset=0; offset<size; offset+=CHUNK_BYTES) {
+    {
+      std::unique_lock<std::mutex> lock(files_mutex);
+      if(quit || b != batch) {
+        complete = false;
+        break;
+      }
+    }
+
+    size_t n = std::min(CHUNK_BYTES, size - offset);
+    posix_fadvise(fd, offset, n, POSIX_FADV_WILLNEED);
+
+    // pace requests so playback reads keep most of the disk
+    std::this_thread::sleep_for(std::chrono::duration<double>(n/bytes_per_second));
+  }
+
+  ::close(fd);
+  return complete;
+#else
+  (void)filename;
+  (void)b;
+  return true;
+#endif
+}
@@ -0,0 +1,57 @@
+#ifndef _FILEPREFETCHER_HPP
+#define _FILEPREFETCHER_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstddef>
+
+// warm page cache with audio files before they are played, so first
+// trigger of a pad does not wait for a cold disk. Kernel is asked to read
+// files ahead from a background thread, at a limited rate so playback
+// reads are not starved. Only does something on Linux.
+class FilePrefetcher {
+
+  public:
+    // first max_bytes of each file are read ahead, whole file when smaller,
+    // at most bytes_per_second
+    FilePrefetcher(size_t max_bytes, double bytes_per_second);
+    ~FilePrefetcher();
+
+    // read files ahead in order, files of previous call not done yet are
+    // dropped
+    void prefetch(const std::vector<std::string> &filenames);
+
+    // files done and total number of files of last call
+    void get_progress(size_t &done, size_t &total);
+
+  private:
+
+    void run(void);
+
+    // read ahead one file, return false if it was interrupted
+    bool prefetch_file(const std::string &filename, unsigned batch);
+
+    // read ahead this much at once
+    static const size_t CHUNK_BYTES = 1024*1024;
+
+    const size_t max_bytes;
+    const double bytes_per_second;
+
+    std::vector<std::string> files;
+    // files of current batch already read ahead
+    size_t done;
+    // bumped on each prefetch call
+    unsigned batch;
+    std::mutex files_mutex;
+    std::condition_variable files_cv;
+
+    std::thread prefetch_thread;
+
+    // thread will quit when true
+    bool quit;
+};
+
+#endif//_FILEPREFETCHER_HPP
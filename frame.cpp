@@ -6,21 +6,52 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <locale>
 #include <wx/filedlg.h>
 #include <wx/stdpaths.h>
 #include <wx/filename.h>
+#include <wx/textdlg.h>
+#include <wx/numdlg.h>
+#include <wx/display.h>
+#include <wx/dcbuffer.h>
 
 #include "frame.hpp"
+#include "audioarena.hpp"
+#include "downmix.hpp"
 
 enum {
   FRAME_BUTTON_NEW_COLUMN = 0,
   FRAME_BUTTON_NEW_ROW,
   FRAME_BUTTON_REMOVE_COLUMN,
   FRAME_BUTTON_REMOVE_ROW,
+  FRAME_TIMER_STATS,
+  FRAME_MENU_RESCAN_DEVICES,
+  FRAME_MENU_CALIBRATE,
+  // one id per output device, kept clear of output mode ids
+  FRAME_MENU_DEVICE = wxID_HIGHEST + 1,
+  FRAME_MENU_DEVICE_LAST = FRAME_MENU_DEVICE + 255,
+  // one id per output sample format
+  FRAME_MENU_FORMAT,
+  FRAME_MENU_FORMAT_LAST = FRAME_MENU_FORMAT + OUTPUT_FORMAT_INT16,
+  // host API choice first, then one id per buffer size
+  FRAME_MENU_BUFFER,
+  FRAME_MENU_BUFFER_LAST = FRAME_MENU_BUFFER + 15,
 };
 
 wxBEGIN_EVENT_TABLE(SoundboardFrame, wxFrame)
   EVT_SIZE(SoundboardFrame::on_size)
+  EVT_CHAR_HOOK(SoundboardFrame::on_char_hook)
+  EVT_TIMER(FRAME_TIMER_STATS, SoundboardFrame::on_stats_timer)
+  EVT_MENU(FRAME_MENU_RESCAN_DEVICES, SoundboardFrame::on_rescan_devices_menu)
+  EVT_MENU_RANGE(FRAME_MENU_DEVICE, FRAME_MENU_DEVICE_LAST, SoundboardFrame::on_device_menu)
+  EVT_MENU_RANGE(FRAME_MENU_FORMAT, FRAME_MENU_FORMAT_LAST, SoundboardFrame::on_format_menu)
+  EVT_MENU_RANGE(FRAME_MENU_BUFFER, FRAME_MENU_BUFFER_LAST, SoundboardFrame::on_buffer_menu)
+  EVT_MENU(FRAME_MENU_CALIBRATE, SoundboardFrame::on_calibrate_menu)
   EVT_BUTTON(FRAME_BUTTON_NEW_COLUMN, SoundboardFrame::on_button_new_column)
   EVT_BUTTON(FRAME_BUTTON_NEW_ROW, SoundboardFrame::on_button_new_row)
   EVT_BUTTON(FRAME_BUTTON_REMOVE_COLUMN, SoundboardFrame::on_button_remove_column)
@@ -29,28 +60,23 @@ wxEND_EVENT_TABLE()
 
 SoundboardFrame::SoundboardFrame(const wxString& title, const wxPoint& pos, const wxSize& size)
   :wxFrame(NULL, wxID_ANY, title, pos, size),
-  mixer(std::make_shared<AudioMixer>()),
+  latency_count(0),
+  prefetch_done(0),
+  prefetch_total(0),
+  arena_overflows(0),
   panel(NULL) {
 
   // setup menubar
   menu = new wxMenu();
 
-  // build output device menu
+  // build output device menu, filled once configuration is loaded
   menu_device = new wxMenu();
-
-  for(auto device : mixer->get_devices()) {
-    PaDeviceIndex idx = device.first;
-    std::string& name = device.second;
-    
-    menu_device->AppendRadioItem(idx,wxString(name));
-    Bind(wxEVT_COMMAND_MENU_SELECTED, &SoundboardFrame::on_device_menu, this, idx);
-  }
   menu->AppendSubMenu(menu_device, "&Output device", "Select output device");
 
   // build output mode menu
   menu_mode = new wxMenu();
 
-  for(auto mode : mixer->get_modes()) {
+  for(auto mode : MIXER_MODES) {
     auto idx = mode.first;
     std::string& name = mode.second;
 
@@ -67,6 +93,8 @@ SoundboardFrame::SoundboardFrame(const wxString& title, const wxPoint& pos, cons
 
   SetMenuBar(menubar);
 
+  CreateStatusBar();
+
   // setup rest of layout
   ugs = new wxGridBagSizer(0,0);
   ugs->SetRows(2);
@@ -93,20 +121,70 @@ SoundboardFrame::SoundboardFrame(const wxString& title, const wxPoint& pos, cons
 
   set_sizer_and_fit();
 
-  // load device
-  auto idx = mixer->get_default_device();
+  // track key releases to tell pad key presses from their auto repeats
+  wxEvtHandler::AddFilter(this);
+
+  show_arena_status();
+
+  // load device, it is opened as soon as mixer is done scanning devices,
+  // meanwhile menu shows devices known from last run
   auto devname = panel->configuration_get_string("device",std::string());
-  if(!devname.empty()) {
-    auto _idx = mixer->get_device_by_name(devname);
-    if(_idx > paNoDevice)
-      idx = _idx;
-  }
-  set_mixer_device(idx);
+  mixer->set_output_format(get_device_format());
+  mixer->set_output_buffer_frames(get_device_buffer_frames());
+  mixer->set_device(devname);
+  update_device_menu(load_device_cache(), devname);
+  mixer->set_devices_callback([this]() {
+    CallAfter(&SoundboardFrame::on_devices_scanned);
+  });
+  mixer->set_calibration_callback([this](unsigned long frames) {
+    CallAfter(&SoundboardFrame::on_calibrated, frames);
+  });
+  mixer->scan_devices();
+
+  // pads follow players as soon as they start or stop
+  mixer->set_events_callback([this]() {
+    CallAfter(&SoundboardFrame::on_mixer_events);
+  });
 
   // load mode
   AudioMixerMode mode = (AudioMixerMode)panel->configuration_get_int("mode",MIXER_MODE_STEREO);
   set_mixer_mode(mode);
 
+  start_control_server();
+
+  // listen to midi controllers
+  if(midi->open(title.ToStdString()))
+    midi->start();
+
+  stats_timer = new wxTimer(this, FRAME_TIMER_STATS);
+  stats_timer->Start(500);
+}
+
+SoundboardFrame::~SoundboardFrame() {
+  wxEvtHandler::RemoveFilter(this);
+  mixer->set_devices_callback(nullptr);
+  mixer->set_calibration_callback(nullptr);
+  mixer->set_events_callback(nullptr);
+  stats_timer->Stop();
+  // stop dispatching commands before players go away
+  control_server.reset();
+  midi->exit();
+  midi->join();
+}
+
+void SoundboardFrame::start_control_server() {
+  control_server = std::make_unique<ControlServer>(mixer);
+
+  auto path = panel->configuration_get_string("control-socket",
+    panel->configuration_sibling_path("sock"));
+  if(!path.empty())
+    control_server->open_unix(path);
+
+  auto port = panel->configuration_get_int("control-udp-port", 0);
+  if(port > 0)
+    control_server->open_udp(port);
+
+  control_server->start();
 }
 void SoundboardFrame::set_sizer_and_fit() {
   SetMinSize(wxDefaultSize);
@@ -121,6 +199,95 @@ void SoundboardFrame::on_size(wxSizeEvent& event) {
   event.Skip();
 }
 
+void SoundboardFrame::on_char_hook(wxKeyEvent& event) {
+  // time key press before doing any work
+  double now = mixer->get_stream_time();
+
+  // pad keys only go with shift, others are menu accelerators
+  AudioPlayerID id = panel->get_hotkey_player(event.GetKeyCode());
+  if(id == 0 || (event.GetModifiers() & ~wxMOD_SHIFT) != 0) {
+    // not a pad shortcut, let focused control handle it
+    event.Skip();
+    return;
+  }
+
+  // holding key down triggers pad once
+  if(!held_keys.insert(event.GetKeyCode()).second)
+    return;
+
+  // post straight to mixer, shift stops pad instead of triggering it
+  AudioMixerCommands batch;
+  if(event.GetModifiers() == wxMOD_SHIFT) {
+    mixer->collect_stop(id, -1, batch);
+  }
+  else {
+    mixer->collect_trigger(id, -1, batch);
+    for(auto& command: batch) {
+      if(command.type == MIXER_COMMAND_START)
+        command.time = now;
+    }
+  }
+  mixer->post(batch);
+}
+
+int SoundboardFrame::FilterEvent(wxEvent& event) {
+  auto type = event.GetEventType();
+  if(type == wxEVT_KEY_UP)
+    held_keys.erase(static_cast<wxKeyEvent&>(event).GetKeyCode());
+  // releases are missed while another application has focus
+  else if(type == wxEVT_ACTIVATE_APP && !static_cast<wxActivateEvent&>(event).GetActive())
+    held_keys.clear();
+  return Event_Skip;
+}
+
+void SoundboardFrame::show_arena_status(void) {
+  // audio memory may page fault if it could not be locked, and so may
+  // allocations that did not fit in it
+  auto& arena = AudioArena::get();
+  arena_overflows = arena.get_overflows();
+  wxString status = arena.get_locked_bytes() > 0
+    ? wxString::Format("audio memory: %d MB locked", (int)(arena.get_locked_bytes() >> 20))
+    : wxString::Format("audio memory not locked: %s", arena.get_lock_error());
+  if(arena_overflows > 0)
+    status += wxString::Format(", %d allocations did not fit", (int)arena_overflows);
+  SetStatusText(status);
+}
+
+void SoundboardFrame::on_stats_timer(wxTimerEvent& event) {
+  // audio memory ran out since last check
+  if(AudioArena::get().get_overflows() != arena_overflows) {
+    show_arena_status();
+    return;
+  }
+
+  // report page cache warming while it goes on
+  size_t done, total;
+  panel->get_prefetch_progress(done, total);
+  if(done != prefetch_done || total != prefetch_total) {
+    prefetch_done = done;
+    prefetch_total = total;
+    if(done < total)
+      SetStatusText(wxString::Format("prefetching files %d/%d", (int)done, (int)total));
+    else if(total > 0)
+      SetStatusText(wxString::Format("%d files prefetched", (int)total));
+    return;
+  }
+
+  // status bar is shared with mixer events, only show new measures
+  auto l = mixer->get_trigger_latency();
+  if(l.count == latency_count)
+    return;
+  latency_count = l.count;
+  SetStatusText(wxString::Format("key latency: last %.1f ms, mean %.1f ms, min %.1f ms, max %.1f ms",
+    1000*l.last_s, 1000*l.mean_s, 1000*l.min_s, 1000*l.max_s));
+}
+
+void SoundboardFrame::on_mixer_events(void) {
+  auto message = panel->process_mixer_events();
+  if(!message.empty())
+    SetStatusText(message);
+}
+
 void SoundboardFrame::on_button_remove_column(wxCommandEvent& event) {
   panel->increment_player_grid_size(0,-1);
   set_sizer_and_fit();
@@ -142,16 +309,146 @@ void SoundboardFrame::on_button_new_row(wxCommandEvent& event) {
 }
 
 void SoundboardFrame::on_device_menu(wxCommandEvent& event) {
-  // get selected device index
-  PaDeviceIndex idx  = event.GetId();
-  set_mixer_device(idx);
-  panel->configuration_set_string("device",mixer->get_device_name(idx));
+  // get selected device name
+  size_t i = event.GetId() - FRAME_MENU_DEVICE;
+  if(i >= device_names.size())
+    return;
+  auto name = device_names[i];
+  panel->configuration_set_string("device",name);
+  mixer->set_output_format(get_device_format());
+  mixer->set_output_buffer_frames(get_device_buffer_frames());
+  mixer->set_device(name);
+  update_device_menu(device_names, name);
 }
 
-void SoundboardFrame::set_mixer_device(PaDeviceIndex idx) {
-  mixer->set_device(idx);
-  // set menu items checks
-  menu_device->Check(idx,true);
+void SoundboardFrame::on_format_menu(wxCommandEvent& event) {
+  auto format = (OutputFormat)(event.GetId() - FRAME_MENU_FORMAT);
+  mixer->set_output_format(format);
+  panel->configuration_set_int(get_device_setting_key("output-format"), format);
+}
+
+std::string SoundboardFrame::get_device_setting_key(const std::string &setting) {
+  auto name = panel->configuration_get_string("device", std::string());
+  return setting + "/" + (name.empty() ? "default" : name);
+}
+
+OutputFormat SoundboardFrame::get_device_format(void) {
+  return (OutputFormat)panel->configuration_get_int(get_device_setting_key("output-format"),
+    OUTPUT_FORMAT_AUTO);
+}
+
+void SoundboardFrame::on_buffer_menu(wxCommandEvent& event) {
+  // manual choice overrides calibrated one
+  size_t i = event.GetId() - FRAME_MENU_BUFFER;
+  auto sizes = AudioMixer::get_buffer_sizes();
+  unsigned long frames = i > 0 && i <= sizes.size() ? sizes[i - 1] : 0;
+  mixer->set_output_buffer_frames(frames);
+  panel->configuration_set_int(get_device_setting_key("buffer-frames"), frames);
+}
+
+void SoundboardFrame::on_calibrate_menu(wxCommandEvent& event) {
+  if(mixer->is_calibrating())
+    return;
+  mixer->calibrate();
+  SetStatusText("calibrating output buffer size, keep pads silent...");
+}
+
+void SoundboardFrame::on_calibrated(unsigned long frames) {
+  if(frames > 0) {
+    panel->configuration_set_int(get_device_setting_key("buffer-frames"), frames);
+    SetStatusText(wxString::Format("output buffer calibrated to %d frames (%.1f ms)",
+      (int)frames, 1000.0*frames/mixer->get_samplerate()));
+  }
+  else {
+    SetStatusText("calibration failed, output buffer size unchanged");
+  }
+  update_device_menu(device_names, menu_device_name);
+}
+
+unsigned long SoundboardFrame::get_device_buffer_frames(void) {
+  return std::max(0, panel->configuration_get_int(get_device_setting_key("buffer-frames"), 0));
+}
+
+void SoundboardFrame::on_rescan_devices_menu(wxCommandEvent& event) {
+  mixer->scan_devices();
+  SetStatusText("scanning audio devices...");
+}
+
+void SoundboardFrame::on_devices_scanned(void) {
+  auto names = mixer->get_devices();
+  update_device_menu(names, mixer->get_device());
+  save_device_cache(names);
+  SetStatusText(wxString::Format("%d audio devices found", (int)names.size()));
+}
+
+void SoundboardFrame::update_device_menu(const std::vector<std::string> &names,
+  const std::string &selected) {
+
+  while(menu_device->GetMenuItemCount() > 0)
+    menu_device->Destroy(menu_device->FindItemByPosition(0));
+
+  device_names = names;
+  if(device_names.size() > FRAME_MENU_DEVICE_LAST - FRAME_MENU_DEVICE + 1)
+    device_names.resize(FRAME_MENU_DEVICE_LAST - FRAME_MENU_DEVICE + 1);
+
+  for(size_t i=0; i<device_names.size(); i++) {
+    menu_device->AppendRadioItem(FRAME_MENU_DEVICE + i, wxString(device_names[i]));
+    // set menu items checks
+    if(device_names[i] == selected)
+      menu_device->Check(FRAME_MENU_DEVICE + i, true);
+  }
+  menu_device->AppendSeparator();
+
+  // sample formats of selected device, all of them are offered until
+  // devices are scanned
+  menu_device_name = selected;
+  auto formats = mixer->get_device_formats(selected);
+  auto menu_format = new wxMenu();
+  for(int f=OUTPUT_FORMAT_AUTO; f<=OUTPUT_FORMAT_INT16; f++) {
+    menu_format->AppendRadioItem(FRAME_MENU_FORMAT + f, output_format_name((OutputFormat)f));
+    bool supported = f == OUTPUT_FORMAT_AUTO || formats.empty()
+      || std::find(formats.begin(), formats.end(), f) != formats.end();
+    menu_format->Enable(FRAME_MENU_FORMAT + f, supported);
+  }
+  menu_format->Check(FRAME_MENU_FORMAT + mixer->get_output_format(), true);
+  menu_device->AppendSubMenu(menu_format, "&Sample format", "Select output sample format");
+
+  // buffer sizes of selected device, auto lets host API choose
+  auto sizes = AudioMixer::get_buffer_sizes();
+  auto frames = mixer->get_output_buffer_frames();
+  auto menu_buffer = new wxMenu();
+  menu_buffer->AppendRadioItem(FRAME_MENU_BUFFER, "Auto");
+  for(size_t i=0; i<sizes.size(); i++) {
+    menu_buffer->AppendRadioItem(FRAME_MENU_BUFFER + i + 1,
+      wxString::Format("%d frames", (int)sizes[i]));
+    if(sizes[i] == frames)
+      menu_buffer->Check(FRAME_MENU_BUFFER + i + 1, true);
+  }
+  menu_buffer->AppendSeparator();
+  menu_buffer->Append(FRAME_MENU_CALIBRATE, "&Calibrate", "Find smallest stable buffer size");
+  menu_device->AppendSubMenu(menu_buffer, "&Buffer size", "Select output buffer size");
+
+  menu_device->Append(FRAME_MENU_RESCAN_DEVICES, wxT("Rescan devices"));
+}
+
+std::vector<std::string> SoundboardFrame::load_device_cache(void) {
+  std::vector<std::string> names;
+  std::ifstream ifile(panel->configuration_sibling_path("devices"));
+  std::string name;
+  while(std::getline(ifile, name)) {
+    if(!name.empty())
+      names.push_back(name);
+  }
+  return names;
+}
+
+void SoundboardFrame::save_device_cache(const std::vector<std::string> &names) {
+  auto path = panel->configuration_sibling_path("devices");
+  if(path.empty())
+    return;
+  std::ofstream ofile(path, std::ios::trunc);
+  for(auto const& name: names)
+    ofile<<name<<"\n";
 }
 
 void SoundboardFrame::on_mode_menu(wxCommandEvent& event) {
@@ -168,27 +465,164 @@ void SoundboardFrame::set_mixer_mode(AudioMixerMode idx) {
 }
 
 std::shared_ptr<AudioMixer> SoundboardFrame::get_mixer() {
+  // created once main panel has reserved audio memory, mixer buffers are
+  // taken from it
+  if(!mixer)
+    mixer = std::make_shared<AudioMixer>();
   return mixer;
 }
 
+std::shared_ptr<MidiInput> SoundboardFrame::get_midi() {
+  if(!midi)
+    midi = std::make_shared<MidiInput>(get_mixer());
+  return midi;
+}
+
+enum {
+  MAIN_PANEL_TIMER_REFRESH = 0,
+};
+
+// locked audio memory reserved at startup unless configured, a larger
+// sample cache has to be asked for with a larger arena
+static const int AUDIO_ARENA_DEFAULT_MB = 64;
+static const int AUDIO_ARENA_MAX_MB = 16384;
+// audio memory left to players and decoder queues next to sample cache
+static const int AUDIO_ARENA_HEADROOM_MB = 32;
+
 wxBEGIN_EVENT_TABLE(SoundboardMainPanel, wxPanel)
+  EVT_TIMER(MAIN_PANEL_TIMER_REFRESH, SoundboardMainPanel::on_refresh_timer)
 wxEND_EVENT_TABLE()
 
 SoundboardMainPanel::SoundboardMainPanel(SoundboardFrame *parent, std::string app_name)
-  :wxPanel(parent) {
+  :wxPanel(parent),
+  nrows(0),
+  ncols(0),
+  refresh_ms(0) {
 
   // load configuration from disk
   load_configuration_from_file(app_name);
 
+  // players and their buffers are taken from locked memory from now on
+  int arena_mb = std::max(1, std::min(AUDIO_ARENA_MAX_MB,
+    configuration_get_int("audio-arena-mb", AUDIO_ARENA_DEFAULT_MB)));
+  AudioArena::get().reserve((size_t)arena_mb << 20,
+    configuration_get_int("audio-arena-huge-pages", 0) != 0);
+
+  // sample cache lives in arena too, next to headroom for players and
+  // decoder queues or half of arena when it is smaller than that
+  int cache_max_mb = arena_mb - std::min(arena_mb/2, AUDIO_ARENA_HEADROOM_MB);
+  int cache_mb = std::max(0, std::min(cache_max_mb,
+    configuration_get_int("sample-cache-mb", cache_max_mb)));
+
+  // multichannel files are mixed down to stereo with these levels
+  auto levels = downmix_default_levels();
+  levels.center = configuration_get_float("downmix-center", levels.center);
+  levels.surround = configuration_get_float("downmix-surround", levels.surround);
+  levels.lfe = configuration_get_float("downmix-lfe", levels.lfe);
+  downmix_set_levels(levels);
+
   // create audio mixer
   mixer = parent->get_mixer();
+  midi = parent->get_midi();
+
+  // analysis results are cached next to configuration file
+  auto analysis_dir = configuration_sibling_path("analysis");
+  if(!analysis_dir.empty() && !wxDirExists(analysis_dir))
+    wxFileName::Mkdir(analysis_dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+  analyzer = std::make_shared<AudioAnalyzer>(analysis_dir);
+
+  // short files are played from memory, stored as 16 bits samples
+  auto format = configuration_get_string("sample-cache-format", "int16") == "half"
+    ? SAMPLE_FORMAT_HALF : SAMPLE_FORMAT_INT16;
+  mixer->set_sample_cache(std::make_shared<SampleCache>(format,
+    configuration_get_float("sample-cache-seconds", 30.0), (size_t)cache_mb << 20));
+
+  // pads read their files as soon as they are created
+  prefetcher = std::make_unique<FilePrefetcher>(
+    (size_t)std::max(0, configuration_get_int("prefetch-mb", 8)) << 20,
+    std::max(1.0f, configuration_get_float("prefetch-rate-mb", 32.0))*(1 << 20));
+  prefetch_board();
+
+  grid = new SoundboardPadGrid(this);
+  auto sizer = new wxBoxSizer(wxVERTICAL);
+  sizer->Add(grid, 1, wxEXPAND);
+
+  set_player_grid_size(configuration_get_int("grid-ncols", 1),
+    configuration_get_int("grid-nrows", 1));
+  SetSizerAndFit(sizer);
+
+  // refresh pads once per display frame
+  int refresh_hz = wxDisplay().GetCurrentMode().GetRefresh();
+  if(refresh_hz <= 0)
+    refresh_hz = 60;
+  refresh_ms = std::max(1, 1000/refresh_hz);
+  refresh_timer = new wxTimer(this, MAIN_PANEL_TIMER_REFRESH);
+  wake_refresh();
+}
 
-  gs = new wxGridBagSizer(0,0);
+SoundboardMainPanel::~SoundboardMainPanel() {
+  refresh_timer->Stop();
+  // pads unbind themselves from hotkeys, remove them while map is alive
+  pads.clear();
+}
+
+void SoundboardMainPanel::on_refresh_timer(wxTimerEvent& event) {
+  // nothing moves anymore, next mixer event wakes refresh up
+  if(!refresh_pads())
+    refresh_timer->Stop();
+}
 
-  auto ncols = configuration_get_int("grid-ncols", 1);
-  auto nrows = configuration_get_int("grid-nrows", 1);
-  set_player_grid_size(ncols, nrows);
-  SetSizerAndFit(gs);
+void SoundboardMainPanel::wake_refresh(void) {
+  if(!refresh_timer->IsRunning())
+    refresh_timer->Start(refresh_ms);
+}
+
+bool SoundboardMainPanel::refresh_pads(void) {
+  // one engine snapshot for all pads
+  mixer->get_player_states(player_states);
+  bool animated = false;
+  for(int i=0;i<nrows;i++)
+  for(int j=0;j<ncols;j++) {
+    auto const& pad = pads[i*ncols + j];
+    auto id = pad->get_player_id();
+    auto slot = AudioMixer::get_player_slot(id);
+    if(slot < player_states.size() && player_states[slot].id == id)
+      grid->refresh_pad(i, j, pad->update(player_states[slot]));
+    animated |= pad->is_animated();
+  }
+  return animated;
+}
+
+wxString SoundboardMainPanel::process_mixer_events(void) {
+  wxString message;
+  bool any = false;
+  audio_mixer_event_t event;
+  while(mixer->pop_event(event)) {
+    any = true;
+
+    const char *what = NULL;
+    switch(event.type) {
+      case MIXER_EVENT_UNDERRUN: what = "decoding too slow"; break;
+      case MIXER_EVENT_DECODE_ERROR: what = "decoding error"; break;
+      default: break;
+    }
+    if(!what)
+      continue;
+
+    // events of removed players are ignored
+    for(size_t k=0; k<pads.size(); k++) {
+      if(pads[k]->get_player_id() == event.id)
+        message = wxString::Format("pad %d,%d: %s", (int)(k/ncols) + 1,
+          (int)(k%ncols) + 1, what);
+    }
+  }
+
+  // show new states now instead of waiting for next tick
+  if(any) {
+    refresh_pads();
+    wake_refresh();
+  }
+  return message;
 }
 
 bool SoundboardMainPanel::load_configuration_from_file(std::string app_name) {
@@ -203,46 +637,90 @@ bool SoundboardMainPanel::load_configuration_from_file(std::string app_name) {
       return false;
   }
   
-  auto filename = wxFileName(local, std::to_string(hash), "conf").GetFullPath();
+  config_basename = wxFileName(local, std::to_string(hash)).GetFullPath().ToStdString();
+  auto filename = wxFileName(local, std::to_string(hash), "session").GetFullPath();
+  // configuration files of previous versions are imported once
+  auto conf_filename = wxFileName(local, std::to_string(hash), "conf").GetFullPath();
 
-  config = std::make_unique<wxFileConfig>(wxT(""), wxT(""), filename);
+  config = std::make_unique<ConfigStore>(filename.ToStdString(), conf_filename.ToStdString());
 
   return true;
 }
 
+std::string SoundboardMainPanel::configuration_sibling_path(const std::string &ext) {
+  if(config_basename.empty())
+    return std::string();
+  return config_basename + "." + ext;
+}
+
+void SoundboardMainPanel::bind_hotkey(int keycode, AudioPlayerID id) {
+  unbind_hotkey(id);
+  if(keycode != WXK_NONE)
+    hotkeys[keycode] = id;
+}
+
+void SoundboardMainPanel::unbind_hotkey(AudioPlayerID id) {
+  for(auto it = hotkeys.begin(); it != hotkeys.end();) {
+    if(it->second == id)
+      it = hotkeys.erase(it);
+    else
+      ++it;
+  }
+}
+
+AudioPlayerID SoundboardMainPanel::get_hotkey_player(int keycode) {
+  auto it = hotkeys.find(keycode);
+  if(it == hotkeys.end())
+    return 0;
+  return it->second;
+}
+
 void SoundboardMainPanel::configuration_set_int(const std::string &key, int v) {
   if(!config)
     return;
 
-  config->Write(key,v);
-  config->Flush();
+  config->write(key, std::to_string(v));
 }
   
 int SoundboardMainPanel::configuration_get_int(const std::string &key, int vdefault ) {
   if(!config)
     return vdefault;
 
-  int rv=0;
-  if(config->Read(key, &rv))
-    return rv;
-  else
+  std::string s;
+  if(!config->read(key, s))
+    return vdefault;
+
+  char *end;
+  long rv = strtol(s.c_str(), &end, 10);
+  if(end == s.c_str())
     return vdefault;
+  return rv;
 }
 
 void SoundboardMainPanel::configuration_set_float(const std::string &key, float v) {
   if(!config)
     return;
 
-  config->Write(key,v);
-  config->Flush();
+  // always use '.' as decimal separator, whatever the locale
+  std::ostringstream os;
+  os.imbue(std::locale::classic());
+  os.precision(9);
+  os<<v;
+  config->write(key, os.str());
 }
 
 float SoundboardMainPanel::configuration_get_float(const std::string &key, float vdefault) {
   if(!config)
     return vdefault;
 
+  std::string s;
+  if(!config->read(key, s))
+    return vdefault;
+
+  std::istringstream is(s);
+  is.imbue(std::locale::classic());
   float rv;
-  if(config->Read(key, &rv))
+  if(is>>rv)
     return rv;
   else
     return vdefault;
@@ -252,113 +730,102 @@ void SoundboardMainPanel::configuration_set_string(const std::string &key, std::
   if(!config)
     return;
 
-  config->Write(key, wxString(v));
-  config->Flush();
+  config->write(key, v);
 }
 
 std::string SoundboardMainPanel::configuration_get_string(const std::string &key, std::string vdefault) {
   if(!config)
     return vdefault;
 
-  wxString rv;
-  if(config->Read(key, &rv))
-    return rv.ToStdString();
+  std::string rv;
+  if(config->read(key, rv))
+    return rv;
   else
     return vdefault;
 }
 
-void SoundboardMainPanel::increment_player_grid_size(int ncols, int nrows) {
-  auto cw = gs->GetCols(), ch = gs->GetRows();
-  set_player_grid_size(cw+ncols, ch+nrows);
-  SetSizerAndFit(gs);
+
+int SoundboardMainPanel::get_rows(void) {
+  return nrows;
 }
 
-void SoundboardMainPanel::set_player_grid_size(int ncols, int nrows) {
-  auto nw = ncols;
-  auto nh = nrows;
+int SoundboardMainPanel::get_cols(void) {
+  return ncols;
+}
 
-  if(nw == 0 || nh == 0)
-    return;   
+SoundboardPad *SoundboardMainPanel::get_pad(int row, int col) {
+  if(row < 0 || row >= nrows || col < 0 || col >= ncols)
+    return NULL;
+  return pads[row*ncols + col].get();
+}
 
-  // save new size
-  configuration_set_int("grid-ncols", ncols);
-  configuration_set_int("grid-nrows", nrows);
+void SoundboardMainPanel::increment_player_grid_size(int dcols, int drows) {
+  set_player_grid_size(ncols+dcols, nrows+drows);
+  Fit();
+  // pads showing up again reopen their files
+  prefetch_board();
+}
 
-  auto cw = gs->GetCols(), ch = gs->GetRows();
-  // remove players
-  // iterating over all lines and old columns
-  for(int i=0;i<nh;i++)
-  for(int j=nw;j<cw;j++) {
-    remove_player_panel_at_position(i,j);
-  }
+void SoundboardMainPanel::prefetch_board(void) {
+  if(!config)
+    return;
+  auto paths = config->read_all("#path");
+  // pads without file
+  paths.erase(std::remove(paths.begin(), paths.end(), std::string()), paths.end());
+  prefetcher->prefetch(paths);
+}
 
-  // iterating over all columns and new lines
-  for(int j=0;j<nw;j++)
-  for(int i=nh;i<ch;i++) {
-    remove_player_panel_at_position(i,j);
-  }
+void SoundboardMainPanel::get_prefetch_progress(size_t &done, size_t &total) {
+  prefetcher->get_progress(done, total);
+}
 
-  // resize grid
-  gs->SetRows(nh);
-  gs->SetCols(nw);
+void SoundboardMainPanel::set_player_grid_size(int nw, int nh) {
+  if(nw == 0 || nh == 0)
+    return;   
+
+  // save new size
+  configuration_set_int("grid-ncols", nw);
+  configuration_set_int("grid-nrows", nh);
 
-  // iterating over all lines and new columns
+  // keep pads still inside grid and create new ones, pads left outside are
+  // removed along with their player
+  std::vector<std::unique_ptr<SoundboardPad>> resized(nw*nh);
   for(int i=0;i<nh;i++)
-  for(int j=cw;j<nw;j++) {
-    create_new_player_panel_at_position(i,j);
+  for(int j=0;j<nw;j++) {
+    if(i < nrows && j < ncols)
+      resized[i*nw + j] = std::move(pads[i*ncols + j]);
+    else
+      resized[i*nw + j] = std::make_unique<SoundboardPad>(this, i, j);
   }
-  // iterating over all columns and new lines
-  for(int j=0;j<nw;j++)
-  for(int i=ch;i<nh;i++) {
-    create_new_player_panel_at_position(i,j);
-  }
-}
+  pads = std::move(resized);
+  nrows = nh;
+  ncols = nw;
 
-void SoundboardMainPanel::create_new_player_panel_at_position(int i, int j) {
-  // check if panel exist
-  auto p = gs->FindItemAtPosition(wxGBPosition(i,j));
-  // if not create it
-  if(!p) {
-    gs->Add(new SoundboardPlayerPanel(this,i,j),
-      wxGBPosition(i,j),
-      wxDefaultSpan,
-      wxEXPAND);
-  }
-}
-
-void SoundboardMainPanel::remove_player_panel_at_position(int i, int j) {
-  // check if panel exist
-  auto p = gs->FindItemAtPosition(wxGBPosition(i,j));
-  // if its the case remove it
-  if(p) {
-    auto w = p->GetWindow();
-    if(w)
-      w->Destroy();
-  }
+  grid->update_layout();
 }
 
 enum {
-  PLAYER_BUTTON_PLAY,
-  PLAYER_BUTTON_LOOP,
-  PLAYER_BUTTON_MUTE,
-  PLAYER_BUTTON_OPEN,
-  PLAYER_TIMER,
-  PLAYER_SLIDER_VOLUME,
+  PLAYER_MENU_TRIGGER_GROUP = 1,
+  PLAYER_MENU_CHOKE_GROUP,
+  PLAYER_MENU_FADE_IN,
+  PLAYER_MENU_FADE_OUT,
+  PLAYER_MENU_FADE_EXPONENTIAL,
+  PLAYER_MENU_TRIM_START,
+  PLAYER_MENU_TRIM_END,
+  PLAYER_MENU_NORMALIZE,
+  PLAYER_MENU_MIDI_NOTE,
+  PLAYER_MENU_MIDI_GATE,
+  PLAYER_MENU_MIDI_CC,
+  PLAYER_MENU_HOTKEY,
 };
 
-wxBEGIN_EVENT_TABLE(SoundboardPlayerPanel, wxPanel)
-  EVT_TOGGLEBUTTON(PLAYER_BUTTON_PLAY, SoundboardPlayerPanel::on_button_play)
-  EVT_TOGGLEBUTTON(PLAYER_BUTTON_LOOP, SoundboardPlayerPanel::on_button_loop)
-  EVT_TOGGLEBUTTON(PLAYER_BUTTON_MUTE, SoundboardPlayerPanel::on_button_mute)
-  EVT_BUTTON(PLAYER_BUTTON_OPEN, SoundboardPlayerPanel::on_button_open)
-  EVT_TIMER(PLAYER_TIMER, SoundboardPlayerPanel::on_timer)
-  EVT_SLIDER(PLAYER_SLIDER_VOLUME, SoundboardPlayerPanel::on_slider)
-wxEND_EVENT_TABLE()
-
-SoundboardPlayerPanel::SoundboardPlayerPanel(SoundboardMainPanel *parent,
-  int x, int y)
-  :wxPanel(parent),
-  xpos(x), ypos(y) {
+SoundboardPad::SoundboardPad(SoundboardMainPanel *parent, int x, int y)
+  :xpos(x), ypos(y),
+  analyzed(false),
+  label(wxT("-")),
+  playing(false),
+  level(0.0),
+  playhead(0) {
 
   // assign mixer shared ptr
   main_panel = parent;
@@ -366,109 +833,228 @@ SoundboardPlayerPanel::SoundboardPlayerPanel(SoundboardMainPanel *parent,
   mixer = main_panel->mixer;
   // create a new player
   pid = mixer->new_player();
+  get_player()->set_position(xpos, ypos);
 
-  // force min/max size 
-  auto sz = wxSize(SoundboardPlayerPanel::WIDTH, SoundboardPlayerPanel::HEIGHT);
-  SetSizeHints(sz,sz);
-
-  // debug
-  //SetBackgroundColour(*wxGREEN);
-
-  auto vbox = new wxBoxSizer(wxVERTICAL);
-  SetSizer(vbox);
-
-  play_button = new wxToggleButton(this, PLAYER_BUTTON_PLAY, wxT("-"));
-
-  vbox->Add(play_button, 6, wxEXPAND);
-
-  vumeter = new SoundboardVUMeter(this);
-  vbox->Add(vumeter, 1, wxEXPAND|wxALL, 2);
-
-  float gain = configuration_get_float("gain", 1.0);
-  int vol = 100*gain;
-  slider_volume = new wxSlider(this, PLAYER_SLIDER_VOLUME, vol, 0, 125);
+  gain = configuration_get_float("gain", 1.0);
   get_player()->set_gain(gain);
-  vbox->Add(slider_volume, 1, wxEXPAND);
 
-  auto hbox = new wxBoxSizer(wxHORIZONTAL);
-  vbox->Add(hbox, 2, wxEXPAND);
-  
-  loop_button = new wxToggleButton(this, PLAYER_BUTTON_LOOP, wxT("L"),
-                                    wxDefaultPosition, wxSize(10,-1));
-  loop_button->SetLabelMarkup("<b>L</b>");
-  loop_button->SetForegroundColour(wxColour(66,119,244,255));
-  hbox->Add(loop_button, 1, wxEXPAND);
-  bool loop = configuration_get_int("loop", false);
-  loop_button->SetValue(loop);
+  loop = configuration_get_int("loop", false);
   get_player()->set_repeat(loop);
 
-  mute_button = new wxToggleButton(this, PLAYER_BUTTON_MUTE, wxT("M"),
-                                    wxDefaultPosition, wxSize(10,-1));
-  mute_button->SetLabelMarkup("<b>M</b>");
-  mute_button->SetForegroundColour(wxColour(244,80,66,255));
-  hbox->Add(mute_button, 1, wxEXPAND);
-  bool mute = configuration_get_int("mute", false);
-  mute_button->SetValue(mute);
+  mute = configuration_get_int("mute", false);
   get_player()->set_mute(mute);
 
-  open_button = new wxButton(this, PLAYER_BUTTON_OPEN, wxT("O"),
-                                    wxDefaultPosition, wxSize(10,-1));
-  hbox->Add(open_button, 1, wxEXPAND);
+  get_player()->set_trigger_group(configuration_get_string("trigger-group", ""));
+  get_player()->set_choke_group(configuration_get_string("choke-group", ""));
+  get_player()->set_fade_in(configuration_get_float("fade-in", get_player()->get_fade_in()));
+  get_player()->set_fade_out(configuration_get_float("fade-out", get_player()->get_fade_out()));
+  get_player()->set_fade_shape((GainRampShape)configuration_get_int("fade-shape", GAIN_RAMP_LINEAR));
+  update_midi_bindings();
+  update_hotkey();
+
   auto path = configuration_get_string("path", "");
   if(!path.empty()) {
     open_file_in_player(path);
-  }
-
 
-  timer = new wxTimer(this, PLAYER_TIMER);
-  timer->Start(100);
+    // summary kept with session applies until file is analyzed again
+    auto summary = std::make_shared<AudioAnalysis>();
+    if(configuration_get_string("analysis-key", "") == main_panel->analyzer->get_cache_key(path)
+      && summary->load_summary(configuration_get_string("analysis", ""))) {
+      analysis = summary;
+      update_range();
+      update_normalization();
+      get_player()->arm();
+    }
+  }
 }
 
-SoundboardPlayerPanel::~SoundboardPlayerPanel() {
-  // stop timer events
-  timer->Stop();
+SoundboardPad::~SoundboardPad() {
+  // forget midi and keyboard bindings
+  main_panel->midi->unbind(pid);
+  main_panel->unbind_hotkey(pid);
   // remove player from mixer
   mixer->remove_player(pid);
 }
 
-void SoundboardPlayerPanel::open_file_in_player(std::string filename) {
+void SoundboardPad::open_file_in_player(std::string filename) {
+  // range of previous file does not apply, new one is set by timer once
+  // file has been analyzed
+  analysis.reset();
+  analyzed = false;
+  overview.clear();
+  get_player()->set_range(0, 0);
+  get_player()->set_normalization(1.0);
+
   get_player()->open(filename);
-  play_button->SetLabelMarkup(wxFileName(filename).GetName());
+  label = wxFileName(filename).GetName();
 }
 
-std::shared_ptr<AudioPlayer> SoundboardPlayerPanel::get_player() {
+AudioPlayer *SoundboardPad::get_player() {
   return mixer->get_player(pid);
 }
 
-void SoundboardPlayerPanel::on_button_play(wxCommandEvent& event) {
-  auto p = get_player();
-  // play if stopped / stop if playing
-  if(!event.IsChecked()) {
-    p->stop();
+AudioPlayerID SoundboardPad::get_player_id(void) {
+  return pid;
+}
+
+wxRect SoundboardPad::get_part_rect(SoundboardPadPart part) {
+  // same proportions as former pad widgets, in tenth of pad height
+  const int U = HEIGHT/10, B = WIDTH/4;
+  switch(part) {
+    case PAD_PART_PLAY:     return wxRect(0, 0, WIDTH, 4*U);
+    case PAD_PART_WAVEFORM: return wxRect(2, 4*U, WIDTH - 4, 2*U);
+    case PAD_PART_VUMETER:  return wxRect(2, 6*U + 2, WIDTH - 4, U - 4);
+    case PAD_PART_SLIDER:   return wxRect(0, 7*U, WIDTH, U);
+    case PAD_PART_LOOP:     return wxRect(0, 8*U, B, 2*U);
+    case PAD_PART_MUTE:     return wxRect(B, 8*U, B, 2*U);
+    case PAD_PART_OPEN:     return wxRect(2*B, 8*U, B, 2*U);
+    case PAD_PART_GROUP:    return wxRect(3*B, 8*U, WIDTH - 3*B, 2*U);
+    default:                return wxRect();
   }
-  else {
-    p->reset();
-    p->play();
+}
+
+SoundboardPadPart SoundboardPad::hit_test(const wxPoint &position) {
+  for(int part=PAD_PART_PLAY; part<=PAD_PART_GROUP; part++) {
+    if(get_part_rect((SoundboardPadPart)part).Contains(position))
+      return (SoundboardPadPart)part;
+  }
+  return PAD_PART_NONE;
+}
+
+// draw a flat button with a centered label
+static void render_button(wxDC &dc, const wxRect &r, const wxString &text,
+  bool pressed, const wxColour &pressed_colour) {
+
+  dc.SetPen(wxPen(wxColour(30,30,30)));
+  dc.SetBrush(wxBrush(pressed ? pressed_colour : wxColour(70,70,70)));
+  dc.DrawRectangle(r);
+  dc.SetTextForeground(*wxWHITE);
+  wxDCClipper clip(dc, r);
+  dc.DrawLabel(text, r, wxALIGN_CENTER);
+}
+
+void SoundboardPad::render(wxDC &dc, const wxPoint &origin) {
+  auto at = [&origin](SoundboardPadPart part) {
+    auto r = get_part_rect(part);
+    r.Offset(origin);
+    return r;
+  };
+
+  dc.SetPen(wxNullPen);
+  dc.SetBrush(wxBrush(wxColour(50,50,50)));
+  dc.DrawRectangle(wxRect(origin.x, origin.y, WIDTH, HEIGHT));
+
+  render_button(dc, at(PAD_PART_PLAY), label, playing, wxColour(66,119,244));
+
+  // waveform overview with playhead
+  auto r = at(PAD_PART_WAVEFORM);
+  dc.SetPen(wxNullPen);
+  dc.SetBrush(wxBrush(wxColour(40,40,40)));
+  dc.DrawRectangle(r);
+  if(!overview.empty()) {
+    dc.SetPen(wxPen(wxColour(66,119,244)));
+    for(size_t x=0; x<overview.size(); x++)
+      dc.DrawLine(r.x + x, r.y + overview[x].first, r.x + x, r.y + overview[x].second + 1);
+    dc.SetPen(wxPen(wxColour(244,80,66)));
+    dc.DrawLine(r.x + playhead, r.y, r.x + playhead, r.y + r.height);
   }
 
+  // vu meter, level on a logarithmic scale
+  r = at(PAD_PART_VUMETER);
+  dc.SetPen(wxNullPen);
+  dc.SetBrush(*wxGREY_BRUSH);
+  dc.DrawRectangle(r);
+  dc.GradientFillLinear(wxRect(r.x, r.y, r.width*level, r.height),
+    *wxGREEN, wxColour(level*255,255,0));
+
+  // gain slider, full scale is 125%
+  r = at(PAD_PART_SLIDER);
+  int knob = r.x + 4 + (r.width - 8)*std::min(1.25f, gain)/1.25f;
+  dc.SetPen(wxPen(wxColour(120,120,120)));
+  dc.DrawLine(r.x + 4, r.y + r.height/2, r.x + r.width - 4, r.y + r.height/2);
+  dc.SetPen(wxPen(wxColour(30,30,30)));
+  dc.SetBrush(wxBrush(wxColour(200,200,200)));
+  dc.DrawRectangle(wxRect(knob - 3, r.y + 2, 7, r.height - 4));
+
+  render_button(dc, at(PAD_PART_LOOP), wxT("L"), loop, wxColour(66,119,244));
+  render_button(dc, at(PAD_PART_MUTE), wxT("M"), mute, wxColour(244,80,66));
+  render_button(dc, at(PAD_PART_OPEN), wxT("O"), false, wxColour());
+  render_button(dc, at(PAD_PART_GROUP), wxT("G"), false, wxColour());
 }
 
-void SoundboardPlayerPanel::on_button_loop(wxCommandEvent& event) {
+wxString SoundboardPad::get_tooltip(SoundboardPadPart part) {
   auto p = get_player();
-  bool b = event.IsChecked();
-  p->set_repeat(b);
-  configuration_set_int("loop",b);
+  switch(part) {
+    case PAD_PART_WAVEFORM:
+      if(analysis && std::isfinite(analysis->loudness_lufs))
+        return wxString::Format("%.1f LUFS, %.1f dBTP",
+          analysis->loudness_lufs, analysis->true_peak_dbtp);
+      return wxString();
+    case PAD_PART_GROUP:
+      return "trigger: " + p->get_trigger_group() + "\nchoke: " + p->get_choke_group();
+    default:
+      return wxString();
+  }
 }
 
-void SoundboardPlayerPanel::on_button_mute(wxCommandEvent& event) {
+unsigned SoundboardPad::click(SoundboardPadPart part, wxWindow *window) {
   auto p = get_player();
-  bool b = event.IsChecked();
-  p->set_mute(b);
-  configuration_set_int("mute",b);
+  switch(part) {
+
+    case PAD_PART_PLAY:
+      // play if stopped / stop if playing, mixer rewinds player and its
+      // trigger group before starting them
+      if(playing)
+        p->stop();
+      else
+        p->play();
+      // drawn state follows player on next tick
+      return 0;
+
+    case PAD_PART_SLIDER:
+      return 0;
+
+    case PAD_PART_LOOP:
+      loop = !loop;
+      p->set_repeat(loop);
+      configuration_set_int("loop",loop);
+      return 1u << PAD_PART_LOOP;
+
+    case PAD_PART_MUTE:
+      mute = !mute;
+      p->set_mute(mute);
+      configuration_set_int("mute",mute);
+      return 1u << PAD_PART_MUTE;
+
+    case PAD_PART_OPEN:
+      ask_file(window);
+      return (1u << PAD_PART_PLAY) | (1u << PAD_PART_WAVEFORM);
+
+    case PAD_PART_GROUP:
+      show_menu(window);
+      return 0;
+
+    default:
+      return 0;
+  }
 }
 
-void SoundboardPlayerPanel::on_button_open(wxCommandEvent& event) {
-  wxFileDialog dialog(this, wxT("Open sample"), "", "",
+unsigned SoundboardPad::drag_slider(int x) {
+  auto r = get_part_rect(PAD_PART_SLIDER);
+  int vol = 125*(x - r.x - 4)/std::max(1, r.width - 8);
+  vol = std::max(0, std::min(125, vol));
+
+  float new_gain = vol/100.0f;
+  if(new_gain == gain)
+    return 0;
+  gain = new_gain;
+  get_player()->set_gain(gain);
+  configuration_set_float("gain",gain);
+  return 1u << PAD_PART_SLIDER;
+}
+
+void SoundboardPad::ask_file(wxWindow *window) {
+  wxFileDialog dialog(window, wxT("Open sample"), "", "",
     "mp3 files (*.mp3)|*.mp3|wav files (*.wav)|*.wav");
 
   // recall last opened directory
@@ -491,90 +1077,472 @@ void SoundboardPlayerPanel::on_button_open(wxCommandEvent& event) {
   configuration_set_string("path",path);
 }
 
-void SoundboardPlayerPanel::on_timer(wxTimerEvent& event) {
-  // if play button is pressed and stream is no longer active
-  if(play_button->GetValue() && !get_player()->is_playing()) {
-    play_button->SetValue(false);
+void SoundboardPad::show_menu(wxWindow *window) {
+  wxMenu menu;
+  menu.Append(PLAYER_MENU_TRIGGER_GROUP, wxT("Trigger group..."));
+  menu.Append(PLAYER_MENU_CHOKE_GROUP, wxT("Choke group..."));
+  menu.AppendSeparator();
+  menu.Append(PLAYER_MENU_FADE_IN, wxT("Fade in time..."));
+  menu.Append(PLAYER_MENU_FADE_OUT, wxT("Fade out time..."));
+  menu.AppendCheckItem(PLAYER_MENU_FADE_EXPONENTIAL, wxT("Exponential fades"));
+  bool exponential = get_player()->get_fade_shape() == GAIN_RAMP_EXPONENTIAL;
+  menu.Check(PLAYER_MENU_FADE_EXPONENTIAL, exponential);
+  menu.AppendSeparator();
+  menu.AppendCheckItem(PLAYER_MENU_TRIM_START, wxT("Skip leading silence"));
+  bool trim_start = configuration_get_int("trim-start", false);
+  menu.Check(PLAYER_MENU_TRIM_START, trim_start);
+  menu.AppendCheckItem(PLAYER_MENU_TRIM_END, wxT("Trim trailing silence"));
+  bool trim_end = configuration_get_int("trim-end", false);
+  menu.Check(PLAYER_MENU_TRIM_END, trim_end);
+  menu.AppendCheckItem(PLAYER_MENU_NORMALIZE, wxT("Normalize loudness"));
+  bool normalize = configuration_get_int("normalize", false);
+  menu.Check(PLAYER_MENU_NORMALIZE, normalize);
+  menu.AppendSeparator();
+  menu.Append(PLAYER_MENU_MIDI_NOTE, wxT("MIDI note..."));
+  menu.AppendCheckItem(PLAYER_MENU_MIDI_GATE, wxT("MIDI note off stops pad"));
+  bool gate = configuration_get_int("midi-gate", false);
+  menu.Check(PLAYER_MENU_MIDI_GATE, gate);
+  menu.Append(PLAYER_MENU_MIDI_CC, wxT("MIDI gain controller..."));
+  menu.AppendSeparator();
+  menu.Append(PLAYER_MENU_HOTKEY, wxT("Keyboard shortcut..."));
+
+  // selecting a check item toggles it
+  switch(window->GetPopupMenuSelectionFromUser(menu)) {
+    case PLAYER_MENU_TRIGGER_GROUP:
+      ask_trigger_group(window);
+      break;
+    case PLAYER_MENU_CHOKE_GROUP:
+      ask_choke_group(window);
+      break;
+    case PLAYER_MENU_FADE_IN:
+      ask_fade_in(window);
+      break;
+    case PLAYER_MENU_FADE_OUT:
+      ask_fade_out(window);
+      break;
+    case PLAYER_MENU_FADE_EXPONENTIAL: {
+      auto shape = exponential ? GAIN_RAMP_LINEAR : GAIN_RAMP_EXPONENTIAL;
+      get_player()->set_fade_shape(shape);
+      configuration_set_int("fade-shape", shape);
+      break;
+    }
+    case PLAYER_MENU_TRIM_START:
+      configuration_set_int("trim-start", !trim_start);
+      update_range();
+      break;
+    case PLAYER_MENU_TRIM_END:
+      configuration_set_int("trim-end", !trim_end);
+      update_range();
+      break;
+    case PLAYER_MENU_NORMALIZE:
+      configuration_set_int("normalize", !normalize);
+      update_normalization();
+      break;
+    case PLAYER_MENU_MIDI_NOTE:
+      ask_midi_note(window);
+      break;
+    case PLAYER_MENU_MIDI_GATE:
+      configuration_set_int("midi-gate", !gate);
+      update_midi_bindings();
+      break;
+    case PLAYER_MENU_MIDI_CC:
+      ask_midi_cc(window);
+      break;
+    case PLAYER_MENU_HOTKEY:
+      ask_hotkey(window);
+      break;
+    default:
+      break;
   }
+}
 
-  // update vu meter
-  vumeter->set_level(get_player()->get_level());
+void SoundboardPad::ask_trigger_group(wxWindow *window) {
+  auto p = get_player();
+  auto group = wxGetTextFromUser(wxT("Pads sharing this name start together"),
+    wxT("Trigger group"), p->get_trigger_group(), window).ToStdString();
+  p->set_trigger_group(group);
+  configuration_set_string("trigger-group", group);
 }
 
-void SoundboardPlayerPanel::on_slider(wxCommandEvent& event) {
-  float gain = (slider_volume->GetValue()/100.0f);
-  get_player()->set_gain(gain);
-  configuration_set_float("gain",gain);
+void SoundboardPad::ask_choke_group(wxWindow *window) {
+  auto p = get_player();
+  auto group = wxGetTextFromUser(wxT("Starting this pad silences pads sharing this name"),
+    wxT("Choke group"), p->get_choke_group(), window).ToStdString();
+  p->set_choke_group(group);
+  configuration_set_string("choke-group", group);
 }
 
-std::string SoundboardPlayerPanel::configuration_own_keyify(const std::string &key) {
+void SoundboardPad::ask_fade_in(wxWindow *window) {
+  auto p = get_player();
+  long ms = wxGetNumberFromUser(wxT("Fade in applied when pad starts"),
+    wxT("milliseconds"), wxT("Fade in time"), 1000*p->get_fade_in(), 0, 60000, window);
+  if(ms < 0)
+    return;
+  p->set_fade_in(ms/1000.0f);
+  configuration_set_float("fade-in", p->get_fade_in());
+}
+
+void SoundboardPad::ask_fade_out(wxWindow *window) {
+  auto p = get_player();
+  long ms = wxGetNumberFromUser(wxT("Fade out applied when pad stops"),
+    wxT("milliseconds"), wxT("Fade out time"), 1000*p->get_fade_out(), 0, 60000, window);
+  if(ms < 0)
+    return;
+  p->set_fade_out(ms/1000.0f);
+  configuration_set_float("fade-out", p->get_fade_out());
+}
+
+void SoundboardPad::ask_midi_note(wxWindow *window) {
+  long note = wxGetNumberFromUser(wxT("Note triggering this pad (-1 for none)"),
+    wxT("note"), wxT("MIDI note"), configuration_get_int("midi-note", -1), -1, 127, window);
+  // cancelled dialog returns -1 as well, which unbinds the pad
+  configuration_set_int("midi-note", note);
+  update_midi_bindings();
+}
+
+void SoundboardPad::ask_midi_cc(wxWindow *window) {
+  long cc = wxGetNumberFromUser(wxT("Controller setting this pad gain (-1 for none)"),
+    wxT("controller"), wxT("MIDI controller"), configuration_get_int("midi-cc", -1), -1, 127, window);
+  configuration_set_int("midi-cc", cc);
+  update_midi_bindings();
+}
+
+void SoundboardPad::update_midi_bindings(void) {
+  auto midi = main_panel->midi;
+  midi->unbind(pid);
+  midi->bind_note(configuration_get_int("midi-note", -1), pid,
+    configuration_get_int("midi-gate", false));
+  midi->bind_cc(configuration_get_int("midi-cc", -1), pid);
+}
+
+void SoundboardPad::ask_hotkey(wxWindow *window) {
+  // show current shortcut
+  int current = configuration_get_int("key", WXK_NONE);
+  wxString name;
+  if(current >= WXK_F1 && current < WXK_F1 + 12)
+    name = wxString::Format("F%d", current - WXK_F1 + 1);
+  else if(current != WXK_NONE)
+    name = wxString::Format("%c", current);
+
+  wxTextEntryDialog dialog(window,
+    wxT("Key triggering this pad (letter, digit or F1-F12, empty for none)\nShift+key stops it"),
+    wxT("Keyboard shortcut"), name);
+  if(dialog.ShowModal() != wxID_OK)
+    return;
+  auto text = dialog.GetValue().Upper().ToStdString();
+
+  int keycode = WXK_NONE;
+  if(text.size() == 1 && isalnum(text[0])) {
+    keycode = text[0];
+  }
+  else if(text.size() > 1 && text[0] == 'F') {
+    int n = atoi(text.c_str() + 1);
+    if(n >= 1 && n <= 12)
+      keycode = WXK_F1 + n - 1;
+  }
+
+  configuration_set_int("key", keycode);
+  update_hotkey();
+}
+
+void SoundboardPad::update_hotkey(void) {
+  main_panel->bind_hotkey(configuration_get_int("key", WXK_NONE), pid);
+}
+
+bool SoundboardPad::is_animated(void) {
+  if(playing || level > 0)
+    return true;
+  // analyzer is polled until it is done with file
+  return !analyzed && !get_player()->get_filename().empty();
+}
+
+unsigned SoundboardPad::update(const audio_player_state_t &state) {
+  unsigned dirty = 0;
+
+  // follow player state, it may be started or choked by another pad
+  if(playing != state.playing) {
+    playing = state.playing;
+    dirty |= 1u << PAD_PART_PLAY;
+  }
+
+  // rewind idle player now so next trigger does not have to
+  if(!playing && !state.armed) {
+    get_player()->arm();
+  }
+
+  // update vu meter, only redrawn when bar length changes
+  float v = std::max(0.0f, std::min(1.0f, state.level));
+  float new_level = std::max(0.0, 1.0 + 0.5*std::log10(v));
+  int w = get_part_rect(PAD_PART_VUMETER).width;
+  if((int)(w*level) != (int)(w*new_level))
+    dirty |= 1u << PAD_PART_VUMETER;
+  level = new_level;
+
+  // poll analyzer until full file analysis is available
+  auto p = get_player();
+  auto filename = p->get_filename();
+  if(!analyzed && !filename.empty()) {
+    auto full = main_panel->analyzer->get(filename);
+    analyzed = full != nullptr;
+    // summary restored from session, if any, is kept on failure
+    if(full && !full->failed) {
+      analysis = full;
+      update_overview();
+      update_range();
+      update_normalization();
+      // keep summary with session for next load
+      configuration_set_string("analysis-key", main_panel->analyzer->get_cache_key(filename));
+      configuration_set_string("analysis", analysis->save_summary());
+      dirty |= 1u << PAD_PART_WAVEFORM;
+    }
+  }
+
+  // player position counts frames played from start of range
+  uint64_t start = p->get_range_start(), end = p->get_range_end();
+  if(end == 0 && analysis)
+    end = analysis->frames;
+  uint64_t position = state.position;
+  if(end > start)
+    position = start + position % (end - start);
+
+  int column = 0;
+  if(analysis && analysis->frames > 0) {
+    // position keeps growing when looping
+    column = (position % analysis->frames)*get_part_rect(PAD_PART_WAVEFORM).width/analysis->frames;
+  }
+  if(playhead != column) {
+    playhead = column;
+    dirty |= 1u << PAD_PART_WAVEFORM;
+  }
+
+  return dirty;
+}
+
+void SoundboardPad::update_overview(void) {
+  overview.clear();
+  // summaries have no peaks to draw
+  if(!analysis || analysis->frames == 0 || analysis->peaks.empty())
+    return;
+
+  // one min/max line per column
+  auto r = get_part_rect(PAD_PART_WAVEFORM);
+  int w = r.width, h = r.height;
+  const uint64_t frames = analysis->frames;
+  overview.resize(w);
+  for(int x=0; x<w; x++) {
+    float min, max;
+    analysis->get_peak(x*frames/w, (x + 1)*frames/w, min, max);
+    overview[x] = std::make_pair(int(h/2 - max*h/2), int(h/2 - min*h/2));
+  }
+}
+
+void SoundboardPad::update_range(void) {
+  uint64_t start = 0, end = 0;
+  // silent files are played whole
+  if(analysis && analysis->end_frame > 0) {
+    if(configuration_get_int("trim-start", false))
+      start = analysis->start_frame;
+    if(configuration_get_int("trim-end", false))
+      end = analysis->end_frame;
+  }
+  get_player()->set_range(start, end);
+}
+
+void SoundboardPad::update_normalization(void) {
+  float normalization = 1.0;
+  if(analysis && configuration_get_int("normalize", false)) {
+    // common target of all pads
+    float target = main_panel->configuration_get_float("loudness-target", -23.0);
+    normalization = analysis->get_normalization_gain(target);
+  }
+  get_player()->set_normalization(normalization);
+}
+
+std::string SoundboardPad::configuration_own_keyify(const std::string &key) {
   return "player#"+std::to_string(xpos) + "#" + std::to_string(ypos) + "#" + key;
 }
 
-void SoundboardPlayerPanel::configuration_set_int(const std::string &key, int v) {
+void SoundboardPad::configuration_set_int(const std::string &key, int v) {
   main_panel->configuration_set_int(configuration_own_keyify(key), v);
 }
   
-int SoundboardPlayerPanel::configuration_get_int(const std::string &key, int vdefault ) {
+int SoundboardPad::configuration_get_int(const std::string &key, int vdefault ) {
   return main_panel->configuration_get_int(configuration_own_keyify(key), vdefault);
 }
 
-void SoundboardPlayerPanel::configuration_set_float(const std::string &key, float v) {
+void SoundboardPad::configuration_set_float(const std::string &key, float v) {
   main_panel->configuration_set_float(configuration_own_keyify(key), v);
 }
 
-float SoundboardPlayerPanel::configuration_get_float(const std::string &key, float vdefault) {
+float SoundboardPad::configuration_get_float(const std::string &key, float vdefault) {
   return main_panel->configuration_get_float(configuration_own_keyify(key), vdefault);
 }
 
-void SoundboardPlayerPanel::configuration_set_string(const std::string &key, std::string v) {
+void SoundboardPad::configuration_set_string(const std::string &key, std::string v) {
   main_panel->configuration_set_string(configuration_own_keyify(key), v);
 }
 
-std::string SoundboardPlayerPanel::configuration_get_string(const std::string &key, std::string vdefault) {
+std::string SoundboardPad::configuration_get_string(const std::string &key, std::string vdefault) {
   return main_panel->configuration_get_string(configuration_own_keyify(key), vdefault);
 }
 
-wxBEGIN_EVENT_TABLE(SoundboardVUMeter, wxPanel)
-  EVT_PAINT(SoundboardVUMeter::paint_event)
+wxBEGIN_EVENT_TABLE(SoundboardPadGrid, wxScrolledCanvas)
+  EVT_PAINT(SoundboardPadGrid::on_paint)
+  EVT_LEFT_DOWN(SoundboardPadGrid::on_left_down)
+  EVT_LEFT_UP(SoundboardPadGrid::on_left_up)
+  EVT_RIGHT_DOWN(SoundboardPadGrid::on_right_down)
+  EVT_MOTION(SoundboardPadGrid::on_motion)
+  EVT_MOUSE_CAPTURE_LOST(SoundboardPadGrid::on_capture_lost)
 wxEND_EVENT_TABLE()
 
-SoundboardVUMeter::SoundboardVUMeter(wxWindow *parent)
-  :wxPanel(parent) {
+SoundboardPadGrid::SoundboardPadGrid(SoundboardMainPanel *parent)
+  :wxScrolledCanvas(parent, wxID_ANY),
+  main_panel(parent),
+  drag_row(-1),
+  drag_col(-1) {
 
-  //SetBackgroundColour(*wxBLUE);
+  // whole window is painted by on_paint
+  SetBackgroundStyle(wxBG_STYLE_PAINT);
+  SetScrollRate(10, 10);
 }
 
-SoundboardVUMeter::~SoundboardVUMeter() {
-  level = 0.0;
-}
+void SoundboardPadGrid::update_layout(void) {
+  // pad being dragged may be gone
+  drag_row = drag_col = -1;
+  if(HasCapture())
+    ReleaseMouse();
 
-void SoundboardVUMeter::set_level(float v) {
+  int w = main_panel->get_cols()*SoundboardPad::WIDTH;
+  int h = main_panel->get_rows()*SoundboardPad::HEIGHT;
+  SetVirtualSize(w, h);
 
-  // plot sound level on a logarithm scale
-  v = std::max(0.0f, std::min(1.0f, v));
-  float new_level = 1.0 + 0.5*std::log10(v);
+  // show as many pads as the screen can hold, scroll to the others
+  auto area = wxDisplay().GetClientArea();
+  int max_w = std::max(SoundboardPad::WIDTH, area.GetWidth() - 100);
+  int max_h = std::max(SoundboardPad::HEIGHT, area.GetHeight() - 150);
+  SetMinClientSize(wxSize(std::min(w, max_w), std::min(h, max_h)));
 
-  bool as_changed = level != new_level;
-  level = new_level;
-  if(as_changed)
-    Refresh();
+  Refresh(false);
 }
 
-void SoundboardVUMeter::paint_event(wxPaintEvent& event) {
-  wxPaintDC dc(this);
-  render(dc);
+void SoundboardPadGrid::refresh_pad(int row, int col, unsigned parts) {
+  if(parts == 0)
+    return;
+
+  auto client = wxRect(wxPoint(0,0), GetClientSize());
+  auto origin = CalcScrolledPosition(wxPoint(col*SoundboardPad::WIDTH, row*SoundboardPad::HEIGHT));
+  for(int part=PAD_PART_PLAY; part<=PAD_PART_GROUP; part++) {
+    if(!(parts & (1u << part)))
+      continue;
+    auto r = SoundboardPad::get_part_rect((SoundboardPadPart)part);
+    r.Offset(origin);
+    // pads scrolled out of view are not invalidated
+    if(r.Intersects(client))
+      RefreshRect(r, false);
+  }
 }
 
-void SoundboardVUMeter::render(wxDC& dc) {
-  auto sz = GetSize();
-  auto w = sz.GetWidth(), h = sz.GetHeight();
-  auto r = wxRect(0,0,w,h);
+void SoundboardPadGrid::on_paint(wxPaintEvent& event) {
+  wxAutoBufferedPaintDC dc(this);
+  DoPrepareDC(dc);
+
+  // damaged area, in board coordinates
+  auto box = GetUpdateRegion().GetBox();
+  box.SetPosition(CalcUnscrolledPosition(box.GetPosition()));
 
   dc.SetPen(wxNullPen);
-  dc.SetBrush(*wxGREY_BRUSH);
-  dc.DrawRectangle(r);
+  dc.SetBrush(wxBrush(wxColour(50,50,50)));
+  dc.DrawRectangle(box);
+
+  // only pads intersecting damaged area are drawn
+  const int W = SoundboardPad::WIDTH, H = SoundboardPad::HEIGHT;
+  int row0 = std::max(0, box.GetTop()/H);
+  int row1 = std::min(main_panel->get_rows() - 1, box.GetBottom()/H);
+  int col0 = std::max(0, box.GetLeft()/W);
+  int col1 = std::min(main_panel->get_cols() - 1, box.GetRight()/W);
+  for(int i=row0; i<=row1; i++)
+  for(int j=col0; j<=col1; j++) {
+    main_panel->get_pad(i, j)->render(dc, wxPoint(j*W, i*H));
+  }
+}
+
+SoundboardPad *SoundboardPadGrid::find_pad(const wxPoint &position,
+  int &row, int &col, wxPoint &offset) {
+
+  auto p = CalcUnscrolledPosition(position);
+  if(p.x < 0 || p.y < 0)
+    return NULL;
+  row = p.y/SoundboardPad::HEIGHT;
+  col = p.x/SoundboardPad::WIDTH;
+  offset = wxPoint(p.x - col*SoundboardPad::WIDTH, p.y - row*SoundboardPad::HEIGHT);
+  return main_panel->get_pad(row, col);
+}
+
+void SoundboardPadGrid::on_left_down(wxMouseEvent& event) {
+  int row, col;
+  wxPoint offset;
+  auto pad = find_pad(event.GetPosition(), row, col, offset);
+  if(!pad)
+    return;
+
+  auto part = SoundboardPad::hit_test(offset);
+  if(part == PAD_PART_SLIDER) {
+    // slider follows mouse until button is released
+    drag_row = row;
+    drag_col = col;
+    CaptureMouse();
+    refresh_pad(row, col, pad->drag_slider(offset.x));
+    return;
+  }
+
+  refresh_pad(row, col, pad->click(part, this));
+  // file may have changed, its analysis is polled on refresh ticks
+  main_panel->wake_refresh();
+}
+
+void SoundboardPadGrid::on_left_up(wxMouseEvent& event) {
+  drag_row = drag_col = -1;
+  if(HasCapture())
+    ReleaseMouse();
+}
+
+void SoundboardPadGrid::on_right_down(wxMouseEvent& event) {
+  int row, col;
+  wxPoint offset;
+  auto pad = find_pad(event.GetPosition(), row, col, offset);
+  if(pad) {
+    pad->show_menu(this);
+    main_panel->wake_refresh();
+  }
+}
+
+void SoundboardPadGrid::on_motion(wxMouseEvent& event) {
+  auto position = event.GetPosition();
+
+  if(drag_row >= 0) {
+    auto pad = main_panel->get_pad(drag_row, drag_col);
+    if(pad) {
+      auto p = CalcUnscrolledPosition(position);
+      refresh_pad(drag_row, drag_col, pad->drag_slider(p.x - drag_col*SoundboardPad::WIDTH));
+    }
+    return;
+  }
+
+  // tooltip of hovered part
+  int row, col;
+  wxPoint offset;
+  auto pad = find_pad(position, row, col, offset);
+  wxString tip;
+  if(pad)
+    tip = pad->get_tooltip(SoundboardPad::hit_test(offset));
+  if(tip == GetToolTipText())
+    return;
+  if(tip.empty())
+    UnsetToolTip();
+  else
+    SetToolTip(tip);
+}
 
-  r = wxRect(0,0,w*level,h);
-  dc.GradientFillLinear(r, *wxGREEN, wxColour(level*255,255,0));
+void SoundboardPadGrid::on_capture_lost(wxMouseCaptureLostEvent& event) {
+  drag_row = drag_col = -1;
 }
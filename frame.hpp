@@ -5,42 +5,72 @@
 #endif
 #include <wx/sizer.h>
 #include <wx/gbsizer.h>
-#include <wx/tglbtn.h>
-#include <wx/fileconf.h>
+#include <wx/scrolwin.h>
+
+#include <set>
 
 #include "audiomixer.hpp"
+#include "controlserver.hpp"
+#include "midiinput.hpp"
+#include "audioanalyzer.hpp"
+#include "configstore.hpp"
+#include "fileprefetcher.hpp"
 
-class SoundboardVUMeter: public wxPanel {
-  
+class SoundboardMainPanel;
+
+// parts of a pad, drawn and hit tested by SoundboardPadGrid
+enum SoundboardPadPart {
+  PAD_PART_NONE = 0,
+  PAD_PART_PLAY,
+  PAD_PART_WAVEFORM,
+  PAD_PART_VUMETER,
+  PAD_PART_SLIDER,
+  PAD_PART_LOOP,
+  PAD_PART_MUTE,
+  PAD_PART_OPEN,
+  PAD_PART_GROUP,
+};
+
+// one player of the board with its settings. A pad owns no window, it is
+// drawn into a cell of the pad grid and receives clicks from it. Methods
+// changing what is drawn return parts to redraw, as a mask of 1<<part.
+class SoundboardPad {
   public:
-    explicit SoundboardVUMeter(wxWindow *parent);
-    ~SoundboardVUMeter();
 
-    void paint_event(wxPaintEvent& event);
-    void paint_now(void);
+    static const int WIDTH = 150;
+    static const int HEIGHT = 150;
+    SoundboardPad(SoundboardMainPanel *parent, int x, int y);
+    ~SoundboardPad();
 
-    void render(wxDC& dc);
+    AudioPlayer *get_player(void);
 
-		void set_level(float);
+    AudioPlayerID get_player_id(void);
 
-  private:
-		
-		float level;
+    // follow engine state, called on each main panel refresh tick
+    unsigned update(const audio_player_state_t &state);
 
-  wxDECLARE_EVENT_TABLE();
-};
+    // true while pad needs refresh ticks: playing, metering or waiting for
+    // its file analysis
+    bool is_animated(void);
 
-class SoundboardMainPanel;
+    // area of part within pad cell
+    static wxRect get_part_rect(SoundboardPadPart part);
 
-class SoundboardPlayerPanel: public wxPanel {
-  public:
+    // part at position within pad cell
+    static SoundboardPadPart hit_test(const wxPoint &position);
 
-    static const int WIDTH = 150;
-    static const int HEIGHT = 150;
-    SoundboardPlayerPanel(SoundboardMainPanel *parent, int x, int y);
-    ~SoundboardPlayerPanel();
+    // draw pad with its cell top left corner at origin
+    void render(wxDC &dc, const wxPoint &origin);
+
+    wxString get_tooltip(SoundboardPadPart part);
+
+    // window is parent of dialogs and menus shown in response
+    unsigned click(SoundboardPadPart part, wxWindow *window);
+
+    void show_menu(wxWindow *window);
 
-    std::shared_ptr<AudioPlayer> get_player(void);
+    // set gain from slider knob position within pad cell
+    unsigned drag_slider(int x);
 
   private:
 
@@ -50,6 +80,8 @@ class SoundboardPlayerPanel: public wxPanel {
 
     void open_file_in_player(std::string filename);
 
+    void ask_file(wxWindow *window);
+
     std::string configuration_own_keyify(const std::string &key);
 
     void configuration_set_int(const std::string &key, int);
@@ -61,30 +93,83 @@ class SoundboardPlayerPanel: public wxPanel {
     void configuration_set_string(const std::string &key, std::string);
     std::string configuration_get_string(const std::string &key, std::string vdefault);
 
-    void on_button_play(wxCommandEvent& event);
-    void on_button_loop(wxCommandEvent& event);
-    void on_button_mute(wxCommandEvent& event);
-    void on_button_open(wxCommandEvent& event);
+    void ask_trigger_group(wxWindow *window);
+    void ask_choke_group(wxWindow *window);
+    void ask_fade_in(wxWindow *window);
+    void ask_fade_out(wxWindow *window);
+    void ask_midi_note(wxWindow *window);
+    void ask_midi_cc(wxWindow *window);
+    void ask_hotkey(wxWindow *window);
+
+    // bind pad to midi note and controller as configured
+    void update_midi_bindings(void);
+
+    // bind pad to keyboard shortcut as configured
+    void update_hotkey(void);
 
-		void on_timer(wxTimerEvent& event);
+    // restrict player to audible part of file as configured
+    void update_range(void);
 
-		void on_slider(wxCommandEvent& event);
+    // bring player to common loudness as configured
+    void update_normalization(void);
 
-    void on_destroy(wxWindowDestroyEvent& event);
+    // waveform columns of current analysis
+    void update_overview(void);
 
     SoundboardMainPanel *main_panel;
     AudioPlayerID pid;
 
-		SoundboardVUMeter *vumeter;
+    // analysis of player file, null until analyzer is done with it or
+    // summary without peaks restored from session
+    std::shared_ptr<const AudioAnalysis> analysis;
+    // analyzer is done with player file, successfully or not
+    bool analyzed;
+
+    // drawn state
+    wxString label;
+    bool playing;
+    bool loop;
+    bool mute;
+    float gain;
+    // vu meter level, 0 to 1 on a logarithmic scale
+    float level;
+    // playhead column in waveform
+    int playhead;
+    // min/max rows of each waveform column, empty without peaks
+    std::vector<std::pair<int,int>> overview;
+};
 
-		wxSlider *slider_volume;
+// board of pads, painted and hit tested as a single window. Only pads
+// intersecting the damaged area are painted and pads only invalidate the
+// parts that changed, so large boards cost little more than small ones.
+class SoundboardPadGrid: public wxScrolledCanvas {
 
-    wxToggleButton *play_button;
-    wxToggleButton *loop_button;
-    wxToggleButton *mute_button;
-    wxButton *open_button;
+  public:
+    explicit SoundboardPadGrid(SoundboardMainPanel *parent);
+
+    // follow board size
+    void update_layout(void);
+
+    // invalidate parts of pad, as a mask of 1<<part
+    void refresh_pad(int row, int col, unsigned parts);
+
+  private:
 
-		wxTimer *timer;
+    void on_paint(wxPaintEvent& event);
+    void on_left_down(wxMouseEvent& event);
+    void on_left_up(wxMouseEvent& event);
+    void on_right_down(wxMouseEvent& event);
+    void on_motion(wxMouseEvent& event);
+    void on_capture_lost(wxMouseCaptureLostEvent& event);
+
+    // pad under window position and position within its cell, null if none
+    SoundboardPad *find_pad(const wxPoint &position, int &row, int &col, wxPoint &offset);
+
+    SoundboardMainPanel *main_panel;
+
+    // cell of pad whose slider is dragged, -1 when none
+    int drag_row;
+    int drag_col;
 
     wxDECLARE_EVENT_TABLE();
 };
@@ -96,9 +181,15 @@ class SoundboardMainPanel: public wxPanel {
   public:
 
     SoundboardMainPanel(SoundboardFrame *parent, std::string app_name);
+    ~SoundboardMainPanel();
  
     std::shared_ptr<AudioMixer> mixer;
 
+    std::shared_ptr<MidiInput> midi;
+
+    // background analysis of player files
+    std::shared_ptr<AudioAnalyzer> analyzer;
+
     void configuration_set_int(const std::string &key, int);
     int configuration_get_int(const std::string &key, int vdefault);
 
@@ -110,48 +201,151 @@ class SoundboardMainPanel: public wxPanel {
 
     void increment_player_grid_size(int,int);
 
+    int get_rows(void);
+    int get_cols(void);
+
+    // pad at grid position, null if outside grid
+    SoundboardPad *get_pad(int row, int col);
+
+    // pop mixer events and refresh their pads right away, return status
+    // message of last event worth reporting, empty if none
+    wxString process_mixer_events(void);
+
+    // restart refresh ticks, they stop once no pad is animated
+    void wake_refresh(void);
+
+    // warm page cache with files of all configured pads
+    void prefetch_board(void);
+    void get_prefetch_progress(size_t &done, size_t &total);
+
+    // path next to configuration file, sharing its name, with extension
+    std::string configuration_sibling_path(const std::string &ext);
+
+    // keyboard shortcuts triggering players
+    void bind_hotkey(int keycode, AudioPlayerID id);
+    void unbind_hotkey(AudioPlayerID id);
+    // return player bound to key, 0 if none
+    AudioPlayerID get_hotkey_player(int keycode);
+
   private:
 
-    wxGridBagSizer *gs;
+    SoundboardPadGrid *grid;
+
+    // pads row by row
+    std::vector<std::unique_ptr<SoundboardPad>> pads;
+    int nrows;
+    int ncols;
  
-    std::unique_ptr<wxFileConfig> config;
+    std::unique_ptr<ConfigStore> config;
 
-    bool load_configuration_from_file(std::string app_name);
+    std::unique_ptr<FilePrefetcher> prefetcher;
+
+    // configuration file path without extension
+    std::string config_basename;
+
+    std::map<int, AudioPlayerID> hotkeys;
 
-    void create_new_player_panel_at_position(int i, int j);
+    // engine state of all players, reused across ticks
+    std::vector<audio_player_state_t> player_states;
 
-    void remove_player_panel_at_position(int i, int j);
+    // single refresh tick for all pads, running while a pad is animated
+    wxTimer *refresh_timer;
+    int refresh_ms;
+
+    void on_refresh_timer(wxTimerEvent& event);
+
+    // update all pads from one engine snapshot, return true if a pad is
+    // still animated
+    bool refresh_pads(void);
+
+    bool load_configuration_from_file(std::string app_name);
 
     void set_player_grid_size(int,int);
 
     wxDECLARE_EVENT_TABLE();
 };
 
-class SoundboardFrame: public wxFrame {
+class SoundboardFrame: public wxFrame, public wxEventFilter {
 
   public:
     SoundboardFrame(const wxString& title, const wxPoint& pos, const wxSize& size);
+    ~SoundboardFrame();
 
+    // sees key releases of every window, char hook only gets key presses
+    int FilterEvent(wxEvent& event);
+
+    // mixer and midi input are created on first call, after audio memory
+    // has been reserved
     std::shared_ptr<AudioMixer> get_mixer();
 
+    std::shared_ptr<MidiInput> get_midi();
+
   private:
 
     wxMenu *menu;
     wxMenu *menu_device;
     wxMenu *menu_mode;
 
+    // device of each device menu item
+    std::vector<std::string> device_names;
+    // device shown as selected, sample formats offered are its own
+    std::string menu_device_name;
+
     wxGridBagSizer *ugs;
 
     void on_device_menu(wxCommandEvent& event);
 
+    void on_rescan_devices_menu(wxCommandEvent& event);
+
+    void on_format_menu(wxCommandEvent& event);
+
+    // configuration key of a per device setting. Settings follow device
+    // selected in configuration, default device included, whose actual
+    // name is only known once devices are scanned.
+    std::string get_device_setting_key(const std::string &setting);
+
+    // sample format saved for selected device, auto if none
+    OutputFormat get_device_format(void);
+
+    void on_buffer_menu(wxCommandEvent& event);
+
+    void on_calibrate_menu(wxCommandEvent& event);
+
+    // called on gui thread once mixer is done calibrating
+    void on_calibrated(unsigned long frames);
+
+    // buffer size saved for selected device, 0 if host API chooses
+    unsigned long get_device_buffer_frames(void);
+
+    // called on gui thread once mixer is done scanning devices
+    void on_devices_scanned(void);
+
+    // called on gui thread when mixer has events waiting
+    void on_mixer_events(void);
+
+    void update_device_menu(const std::vector<std::string> &names,
+      const std::string &selected);
+
+    // device names known from last run, shown until devices are scanned
+    std::vector<std::string> load_device_cache(void);
+    void save_device_cache(const std::vector<std::string> &names);
+
     void on_mode_menu(wxCommandEvent& event);
 
     void on_size(wxSizeEvent& event);
 
-    void set_mixer_device(PaDeviceIndex);
+    // single entry point for all pad keyboard shortcuts
+    void on_char_hook(wxKeyEvent& event);
+    // pad keys pressed and not released yet, their auto repeats are ignored
+    std::set<int> held_keys;
+
+    void on_stats_timer(wxTimerEvent& event);
 
     void set_mixer_mode(AudioMixerMode);
 
+    // show locked audio memory and allocations that did not fit in it
+    void show_arena_status(void);
+
     void on_button_new_column(wxCommandEvent& event);
     void on_button_remove_column(wxCommandEvent& event);
 
@@ -160,7 +354,23 @@ class SoundboardFrame: public wxFrame {
 
     void set_sizer_and_fit(void);
 
+    // start local control sockets as configured
+    void start_control_server(void);
+
     std::shared_ptr<AudioMixer> mixer;
+
+    std::shared_ptr<MidiInput> midi;
+
+    std::unique_ptr<ControlServer> control_server;
+
+    wxTimer *stats_timer;
+    // trigger latency measures already shown
+    unsigned long latency_count;
+    // prefetch progress already shown
+    size_t prefetch_done;
+    size_t prefetch_total;
+    // audio memory overflows already shown
+    size_t arena_overflows;
  
     wxMenuBar *menubar;
     SoundboardMainPanel *panel;
@@ -0,0 +1,149 @@
+#include "framequeue.hpp"
+
+#include <algorithm>
+
+const unsigned FrameQueue::FRAMES;
+const unsigned FrameQueue::MIN_BLOCK_FRAMES;
+constexpr double FrameQueue::WAIT_SECONDS;
+
+// producer jitter decays by this factor on each push, a disk stall is
+// remembered for about a minute of playback
+static const double JITTER_DECAY = 0.999;
+
+FrameQueue::FrameQueue(unsigned max_push)
+  :frames_left(FRAMES),
+  frames_right(FRAMES),
+  head(0),
+  tail(0),
+  max_push(std::min(max_push, FRAMES/2)),
+  low_watermark(0),
+  high_watermark(0),
+  block_frames(0),
+  samplerate_hz(0),
+  jitter_s(0.0),
+  pushed(false),
+  ended(false),
+  closed(false) {
+}
+
+bool FrameQueue::wait_for_space(void) {
+  // time producer took since it last pushed
+  if(pushed) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - last_push;
+    jitter_s = std::max(elapsed.count(), jitter_s*JITTER_DECAY);
+  }
+
+  std::unique_lock<std::mutex> mlock(mutex);
+  update_watermarks();
+  if(tail - head < high_watermark)
+    return !closed;
+
+  // queue is full, sleep until consumer brings it down to low watermark
+  while(tail - head > low_watermark && !closed) {
+    consumed_cv.wait_for(mlock, std::chrono::duration<double>(WAIT_SECONDS));
+    update_watermarks();
+  }
+  return !closed;
+}
+
+void FrameQueue::push(const float *left, const float *right, unsigned n) {
+  n = std::min(n, max_push);
+
+  // each channel lands in at most two contiguous spans of the ring
+  size_t t = tail.load(std::memory_order_relaxed);
+  unsigned start = t & (FRAMES - 1);
+  unsigned first = std::min(n, FRAMES - start);
+  std::copy(left, left + first, frames_left.begin() + start);
+  std::copy(left + first, left + n, frames_left.begin());
+  std::copy(right, right + first, frames_right.begin() + start);
+  std::copy(right + first, right + n, frames_right.begin());
+  tail.store(t + n, std::memory_order_release);
+
+  // a waiting consumer checks queue under mutex before it sleeps
+  {
+    std::unique_lock<std::mutex> mlock(mutex);
+  }
+  available_cv.notify_all();
+
+  last_push = std::chrono::steady_clock::now();
+  pushed = true;
+}
+
+void FrameQueue::set_end(void) {
+  {
+    std::unique_lock<std::mutex> mlock(mutex);
+    ended = true;
+  }
+  available_cv.notify_all();
+}
+
+void FrameQueue::set_samplerate(int rate) {
+  samplerate_hz = rate;
+}
+
+unsigned FrameQueue::try_pop(float *left, float *right, unsigned n) {
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t count = tail.load(std::memory_order_acquire) - h;
+  unsigned m = std::min<size_t>(n, count);
+
+  unsigned start = h & (FRAMES - 1);
+  unsigned first = std::min(m, FRAMES - start);
+  std::copy(frames_left.begin() + start, frames_left.begin() + start + first, left);
+  std::copy(frames_left.begin(), frames_left.begin() + (m - first), left + first);
+  std::copy(frames_right.begin() + start, frames_right.begin() + start + first, right);
+  std::copy(frames_right.begin(), frames_right.begin() + (m - first), right + first);
+  head.store(h + m, std::memory_order_release);
+
+  // wake producer up only once queue is low, so it decodes in batches
+  if(count - m <= low_watermark)
+    consumed_cv.notify_one();
+
+  return m;
+}
+
+unsigned FrameQueue::pop(float *left, float *right, unsigned n) {
+  unsigned done = 0;
+  while(done < n) {
+    done += try_pop(left + done, right + done, n - done);
+    if(done == n)
+      break;
+
+    std::unique_lock<std::mutex> mlock(mutex);
+    if(closed || is_drained())
+      break;
+    if(tail == head)
+      available_cv.wait(mlock);
+  }
+  return done;
+}
+
+bool FrameQueue::is_drained(void) {
+  // end is set after last push, every frame is counted once it is seen
+  return ended && tail == head;
+}
+
+void FrameQueue::set_block_frames(unsigned n) {
+  block_frames = n;
+}
+
+void FrameQueue::close(void) {
+  {
+    std::unique_lock<std::mutex> mlock(mutex);
+    closed = true;
+  }
+  consumed_cv.notify_all();
+  available_cv.notify_all();
+}
+
+void FrameQueue::update_watermarks(void) {
+  unsigned block = std::max<unsigned>(block_frames, MIN_BLOCK_FRAMES);
+  int rate = samplerate_hz;
+  unsigned jitter = rate > 0 ? jitter_s*rate : 0;
+
+  // producer wakes up with a block plus worst producing delay still queued,
+  // and produces at least a block or a whole push before sleeping again
+  const unsigned limit = FRAMES - max_push;
+  unsigned high = std::min(limit, block + jitter + std::max(block, max_push));
+  high_watermark = high;
+  low_watermark = std::min(block + jitter, high/2);
+}
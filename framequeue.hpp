@@ -0,0 +1,98 @@
+#ifndef _FRAMEQUEUE_HPP
+#define _FRAMEQUEUE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+
+#include "audioarena.hpp"
+
+// planar stereo ring between a decoding thread and a single consumer. The
+// producer fills it up to a high watermark then sleeps until the consumer
+// brings it down to a low watermark, so it wakes up for batches of frames.
+// Watermarks follow consumer block size and producer jitter. try_pop never
+// blocks, locks nor allocates, it is safe from the audio callback.
+class FrameQueue {
+
+  public:
+    // producer never pushes more than max_push frames at once
+    explicit FrameQueue(unsigned max_push);
+
+    // producer side
+
+    // sleep until there is space available in the queue, return false
+    // once queue has been closed
+    bool wait_for_space(void);
+
+    // push at most max_push frames, there is room for them once
+    // wait_for_space returned
+    void push(const float *left, const float *right, unsigned n);
+
+    // no frame will be pushed anymore
+    void set_end(void);
+
+    // rate of pushed frames, producer jitter is measured in seconds
+    void set_samplerate(int);
+
+    // consumer side
+
+    // pop at most n frames queued already
+    unsigned try_pop(float *left, float *right, unsigned n);
+
+    // pop n frames, waiting for them until end is reached or queue is closed
+    unsigned pop(float *left, float *right, unsigned n);
+
+    // end was reached and every frame has been popped
+    bool is_drained(void);
+
+    // frames consumer pops at once
+    void set_block_frames(unsigned);
+
+    // make producer give up, waking it up if needed
+    void close(void);
+
+  private:
+
+    // derive watermarks from consumer block size and producer jitter,
+    // mutex held
+    void update_watermarks(void);
+
+    // ring size, large enough for high watermark plus a whole push
+    static const unsigned FRAMES = 8192;
+    // smallest block assumed, consumer block is unknown until first pop
+    static const unsigned MIN_BLOCK_FRAMES = 256;
+    // producer wakes up on its own at least this often, the audio callback
+    // notifies without holding mutex and a notification may be missed
+    static constexpr double WAIT_SECONDS = 0.005;
+
+    ArenaVector<float> frames_left;
+    ArenaVector<float> frames_right;
+    // next frame to pop, only written by consumer
+    std::atomic<size_t> head;
+    // next frame to push, only written by producer
+    std::atomic<size_t> tail;
+
+    const unsigned max_push;
+    std::atomic<unsigned> low_watermark;
+    std::atomic<unsigned> high_watermark;
+    std::atomic<unsigned> block_frames;
+    std::atomic<int> samplerate_hz;
+
+    // longest time producer took between two pushes, decaying, producer only
+    double jitter_s;
+    std::chrono::steady_clock::time_point last_push;
+    bool pushed;
+
+    std::atomic<bool> ended;
+    std::atomic<bool> closed;
+
+    std::mutex mutex;
+    // frames were pushed, end was reached or queue was closed
+    std::condition_variable available_cv;
+    // queue went down to low watermark or was closed
+    std::condition_variable consumed_cv;
+};
+
+#endif//_FRAMEQUEUE_HPP
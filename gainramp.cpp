@@ -0,0 +1,101 @@
+#include "gainramp.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr float GainRamp::EXPONENTIAL_FLOOR;
+
+GainRamp::GainRamp(float value)
+  :value(value),
+  target(value),
+  remaining(0),
+  delay(0),
+  shape(GAIN_RAMP_LINEAR),
+  step(0.0) {
+}
+
+void GainRamp::reset(float v) {
+  value = v;
+  target = v;
+  remaining = 0;
+  delay = 0;
+}
+
+void GainRamp::start(float _target, unsigned long n, GainRampShape _shape,
+  unsigned long _delay) {
+  target = _target;
+  shape = _shape;
+  remaining = n;
+  delay = _delay;
+
+  if(n == 0) {
+    // jump to target, now or once delay is over
+    if(delay == 0)
+      value = target;
+    step = 0.0;
+    return;
+  }
+
+  if(shape == GAIN_RAMP_EXPONENTIAL) {
+    float from = std::max(value, EXPONENTIAL_FLOOR);
+    float to = std::max(target, EXPONENTIAL_FLOOR);
+    value = from;
+    step = std::pow(to/from, 1.0f/n);
+  }
+  else {
+    step = (target - value)/n;
+  }
+}
+
+void GainRamp::render(float *gains, unsigned long n) {
+  // hold current value until ramp begins
+  unsigned long d = std::min(n, delay);
+  std::fill(gains, gains + d, value);
+  delay -= d;
+  gains += d;
+  n -= d;
+  if(n == 0)
+    return;
+
+  unsigned long m = std::min(n, remaining);
+  unsigned long i = 0;
+
+  if(shape == GAIN_RAMP_EXPONENTIAL) {
+    // powers of step for one block, so each block is an independent product
+    float powers[BLOCK];
+    float p = 1.0;
+    for(unsigned k=0; k<BLOCK; k++) {
+      p *= step;
+      powers[k] = p;
+    }
+    float v = value;
+    for(; i + BLOCK <= m; i += BLOCK) {
+      for(unsigned k=0; k<BLOCK; k++)
+        gains[i+k] = v*powers[k];
+      v *= powers[BLOCK-1];
+    }
+    for(; i<m; i++) {
+      v *= step;
+      gains[i] = v;
+    }
+    value = v;
+  }
+  else {
+    const float v = value;
+    const float s = step;
+    for(; i<m; i++)
+      gains[i] = v + (i+1)*s;
+    value = v + m*s;
+  }
+
+  remaining -= m;
+  if(remaining == 0) {
+    // snap to exact target, ramp may drift or stop at exponential floor
+    value = target;
+    if(m > 0)
+      gains[m-1] = target;
+  }
+
+  // hold target for rest of block
+  std::fill(gains + m, gains + n, value);
+}
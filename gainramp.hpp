@@ -0,0 +1,51 @@
+#ifndef _GAINRAMP_HPP
+#define _GAINRAMP_HPP
+
+enum GainRampShape {
+  GAIN_RAMP_LINEAR = 1,
+  GAIN_RAMP_EXPONENTIAL,
+};
+
+// per voice gain envelope, rendered by blocks from the audio thread only
+class GainRamp {
+
+  public:
+    explicit GainRamp(float value = 1.0);
+
+    // jump to value, cancelling any running ramp
+    void reset(float value);
+
+    // ramp from current value to target, reached exactly after n frames,
+    // current value is held for delay frames before ramp begins
+    void start(float target, unsigned long n, GainRampShape shape,
+      unsigned long delay = 0);
+
+    // write next n gains of the envelope to gains
+    void render(float *gains, unsigned long n);
+
+    float get_value(void) { return value; }
+
+    float get_target(void) { return target; }
+
+    // number of frames before target is reached
+    unsigned long get_remaining(void) { return delay + remaining; }
+
+  private:
+
+    // exponential ramps can not reach zero, they start/end at this floor
+    static constexpr float EXPONENTIAL_FLOOR = 1e-4f; // -80dB
+
+    // number of gains computed per unrolled block
+    static const unsigned BLOCK = 8;
+
+    float value;
+    float target;
+    unsigned long remaining;
+    unsigned long delay;
+    GainRampShape shape;
+
+    // added (linear) or multiplied (exponential) to value for each frame
+    float step;
+};
+
+#endif//_GAINRAMP_HPP
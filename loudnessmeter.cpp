@@ -0,0 +1,157 @@
+#include "loudnessmeter.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+// M_PI is not standard
+static const double PI = 3.14159265358979323846;
+
+// loudness of a mean square energy, in LUFS
+static double energy_to_lufs(double z) {
+  return -0.691 + 10*std::log10(z);
+}
+
+LoudnessMeter::LoudnessMeter(int samplerate_hz)
+  :shelf_z(),
+  highpass_z(),
+  subblock_count(0),
+  subblock_energy(0.0),
+  true_peak(0.0) {
+
+  const double rate = samplerate_hz > 0 ? samplerate_hz : 48000;
+
+  // BS.1770 filters, bilinear transform of analog prototypes so they match
+  // the reference 48kHz coefficients at any rate
+  double f0 = 1681.974450955533;
+  double G = 3.999843853973347;
+  double Q = 0.7071752369554196;
+  double K = std::tan(PI*f0/rate);
+  double Vh = std::pow(10.0, G/20);
+  double Vb = std::pow(Vh, 0.4996667741545416);
+  double a0 = 1 + K/Q + K*K;
+  shelf = {(Vh + Vb*K/Q + K*K)/a0, 2*(K*K - Vh)/a0, (Vh - Vb*K/Q + K*K)/a0,
+    2*(K*K - 1)/a0, (1 - K/Q + K*K)/a0};
+
+  f0 = 38.13547087602444;
+  Q = 0.5003270373238773;
+  K = std::tan(PI*f0/rate);
+  a0 = 1 + K/Q + K*K;
+  highpass = {1.0, -2.0, 1.0, 2*(K*K - 1)/a0, (1 - K/Q + K*K)/a0};
+
+  subblock_frames = std::max(1.0, std::round(0.1*rate));
+
+  // windowed sinc interpolator, each phase normalized to unity gain
+  const unsigned N = PHASES*TAPS;
+  for(unsigned p=0; p<PHASES; p++) {
+    double sum = 0;
+    for(unsigned k=0; k<TAPS; k++) {
+      // tap k of phase p delays input by k samples
+      unsigned n = k*PHASES + p;
+      double t = (n - (N - 1)/2.0)/PHASES;
+      double sinc = t == 0 ? 1.0 : std::sin(PI*t)/(PI*t);
+      double window = 0.42 - 0.5*std::cos(2*PI*(n + 0.5)/N)
+        + 0.08*std::cos(4*PI*(n + 0.5)/N);
+      fir[p*TAPS + k] = sinc*window;
+      sum += fir[p*TAPS + k];
+    }
+    for(unsigned k=0; k<TAPS; k++)
+      fir[p*TAPS + k] /= sum;
+  }
+
+  for(auto& h: history)
+    h.assign(TAPS - 1, 0.0f);
+}
+
+void LoudnessMeter::process(const float *left, const float *right, size_t n) {
+  // K-weighted energy, both channels filtered in lockstep (direct form II
+  // transposed)
+  for(size_t i=0; i<n; i++) {
+    double x[2] = {left[i], right[i]};
+    double energy = 0;
+    for(int c=0; c<2; c++) {
+      double y = shelf.b0*x[c] + shelf_z[c][0];
+      shelf_z[c][0] = shelf.b1*x[c] - shelf.a1*y + shelf_z[c][1];
+      shelf_z[c][1] = shelf.b2*x[c] - shelf.a2*y;
+
+      double w = highpass.b0*y + highpass_z[c][0];
+      highpass_z[c][0] = highpass.b1*y - highpass.a1*w + highpass_z[c][1];
+      highpass_z[c][1] = highpass.b2*y - highpass.a2*w;
+
+      energy += w*w;
+    }
+
+    subblock_energy += energy;
+    if(++subblock_count == subblock_frames) {
+      subblocks.push_back(subblock_energy/subblock_frames);
+      subblock_energy = 0;
+      subblock_count = 0;
+    }
+  }
+
+  // true peak, each channel is oversampled one phase and one tap at a time
+  // so the inner loop runs over contiguous samples and vectorizes
+  oversampled.resize(n);
+  for(int c=0; c<2; c++) {
+    auto& h = history[c];
+    h.resize(TAPS - 1 + n);
+    const float *samples = c == 0 ? left : right;
+    std::copy(samples, samples + n, h.begin() + TAPS - 1);
+
+    float peak = 0;
+    for(unsigned p=0; p<PHASES; p++) {
+      std::fill(oversampled.begin(), oversampled.end(), 0.0f);
+      for(unsigned k=0; k<TAPS; k++) {
+        const float tap = fir[p*TAPS + k];
+        const float *x = h.data() + TAPS - 1 - k;
+        float *y = oversampled.data();
+        for(size_t i=0; i<n; i++)
+          y[i] += tap*x[i];
+      }
+      for(size_t i=0; i<n; i++)
+        peak = std::max(peak, std::fabs(oversampled[i]));
+    }
+    true_peak = std::max<double>(true_peak, peak);
+
+    // keep last samples for next call
+    h.erase(h.begin(), h.begin() + n);
+  }
+}
+
+double LoudnessMeter::get_integrated_loudness(void) {
+  // 400ms gating blocks overlapping by 75%
+  std::vector<double> blocks;
+  for(size_t j=0; j+4<=subblocks.size(); j++)
+    blocks.push_back((subblocks[j] + subblocks[j+1] + subblocks[j+2] + subblocks[j+3])/4);
+
+  // absolute gate at -70 LUFS
+  const double absolute = std::pow(10.0, (-70 + 0.691)/10);
+  double sum = 0;
+  size_t count = 0;
+  for(auto z: blocks) {
+    if(z > absolute) {
+      sum += z;
+      count++;
+    }
+  }
+  if(count == 0)
+    return -INFINITY;
+
+  // relative gate 10 LU below absolute gated loudness
+  const double relative = sum/count*std::pow(10.0, -10.0/10);
+  sum = 0;
+  count = 0;
+  for(auto z: blocks) {
+    if(z > absolute && z > relative) {
+      sum += z;
+      count++;
+    }
+  }
+  if(count == 0)
+    return -INFINITY;
+
+  return energy_to_lufs(sum/count);
+}
+
+double LoudnessMeter::get_true_peak(void) {
+  return true_peak;
+}
@@ -0,0 +1,53 @@
+#ifndef _LOUDNESSMETER_HPP
+#define _LOUDNESSMETER_HPP
+
+#include <vector>
+#include <cstddef>
+
+// EBU R128 / ITU-R BS.1770 integrated loudness and true peak of a stereo
+// stream, fed sequentially with decoded frames
+class LoudnessMeter {
+
+  public:
+    explicit LoudnessMeter(int samplerate_hz);
+
+    // n frames of each planar channel
+    void process(const float *left, const float *right, size_t n);
+
+    // gated loudness of everything processed so far in LUFS, -infinity
+    // when stream is silent
+    double get_integrated_loudness(void);
+
+    // highest 4x oversampled sample magnitude, linear
+    double get_true_peak(void);
+
+  private:
+
+    typedef struct {
+      double b0, b1, b2, a1, a2;
+    } biquad_t;
+
+    // K-weighting: high shelf followed by high pass (RLB)
+    biquad_t shelf, highpass;
+    // filter states, one per channel
+    double shelf_z[2][2];
+    double highpass_z[2][2];
+
+    // frames per 100ms sub-block, gating blocks are 4 sub-blocks long
+    size_t subblock_frames;
+    size_t subblock_count;
+    double subblock_energy;
+    // mean square energy of each completed sub-block
+    std::vector<double> subblocks;
+
+    // 4x interpolation filter, taps of phase p are fir[p*TAPS .. p*TAPS+TAPS-1]
+    static const unsigned PHASES = 4;
+    static const unsigned TAPS = 12;
+    float fir[PHASES*TAPS];
+    // previous TAPS-1 samples followed by samples being processed, per channel
+    std::vector<float> history[2];
+    std::vector<float> oversampled;
+    double true_peak;
+};
+
+#endif//_LOUDNESSMETER_HPP
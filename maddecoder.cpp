@@ -1,7 +1,19 @@
 #include "maddecoder.hpp"
+#include "downmix.hpp"
 
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+const size_t MADDecoder::MAPPING_WINDOW;
+const unsigned MADDecoder::MAD_FRAME_FRAMES;
 
 // static functions
 
@@ -9,40 +21,38 @@ enum mad_flow MADDecoder::output_mad_callback(void *data,
   struct mad_header const *header, struct mad_pcm *pcm) {
   // access object
   MADDecoder *mad = static_cast<MADDecoder*>(data);
-  {
-    std::unique_lock<std::mutex> mlock(mad->parameters_mutex);
-    auto& p = mad->get_parameters();
 
-    // for simplicity we will always output stereo from this decoder
-    p.channels = 2;
-    p.bitrate_hz = header->bitrate;
-    p.samplerate_hz = header->samplerate;
-    mad->parameters_updated_cv.notify_all();
-  }
+  // a frame decoded, bit reservoir is filled again
+  mad->reservoir_refill = false;
 
   // sleep until there is space available in the queue
-  mad->wait_for_space_available();
-  // check quit
-  if(mad->quit)
+  if(!mad->frames.wait_for_space() || mad->quit)
     return MAD_FLOW_STOP;
 
-  // decode frame to floats, lock queue
-  {
-    std::unique_lock<std::mutex> mlock(mad->frames_mutex);
-    for(unsigned i=0; i<pcm->length; i++) {
-      float left,right;
-
-      left = MADDecoder::mad_sample_to_float(pcm->samples[0][i]);
-      if(pcm->channels == 2) {
-        right = MADDecoder::mad_sample_to_float(pcm->samples[1][i]);
-      }
-      else {
-        right = left;
-      }
-
-      mad->frames.push({left, right});
-    }
-    mad->frames_available_cv.notify_all();
+  // keep samples of this frame falling within decoded range
+  uint64_t first = mad->position;
+  mad->position += pcm->length;
+  unsigned from = 0, to = pcm->length;
+  if(first < mad->start_frame)
+    from = std::min<uint64_t>(to, mad->start_frame - first);
+  bool end = mad->end_frame > 0 && first + pcm->length >= mad->end_frame;
+  if(end)
+    to = std::max<uint64_t>(from, mad->end_frame > first ? mad->end_frame - first : 0);
+
+  // decode frame to floats, mad output is planar already
+  unsigned n = to - from;
+  const mad_fixed_t *left = pcm->samples[0] + from;
+  const mad_fixed_t *right = pcm->samples[pcm->channels == 2 ? 1 : 0] + from;
+  mad_samples_to_float(left, mad->frame_left, n);
+  mad_samples_to_float(right, mad->frame_right, n);
+  mad->frames.push(mad->frame_left, mad->frame_right, n);
+
+  if(end) {
+    if(!mad->auto_rewind)
+      return MAD_FLOW_STOP;
+    mad->rewind();
+    mad->discard = true;
+    mad->loops++;
   }
 
   return MAD_FLOW_CONTINUE;
@@ -50,11 +60,54 @@ enum mad_flow MADDecoder::output_mad_callback(void *data,
 
 enum mad_flow MADDecoder::error_mad_callback(void *data,
   struct mad_stream *stream, struct mad_frame *frame) {
+  // access object
+  MADDecoder *mad = static_cast<MADDecoder*>(data);
+
+  // losing sync is expected on id3 tags and trailing garbage, first frame
+  // after a rewind or skip may point back into a reservoir never read
+  bool expected = stream->error == MAD_ERROR_LOSTSYNC
+    || (stream->error == MAD_ERROR_BADDATAPTR && mad->reservoir_refill);
+  if(!expected)
+    mad->errors++;
+
+  // header decoded but frame did not, mad skips its output while its
+  // samples still count towards position
+  if(stream->error >= MAD_ERROR_BADCRC)
+    mad->position += 32*MAD_NSBSAMPLES(&frame->header);
 
   return MAD_FLOW_CONTINUE;
 }
 
 enum mad_flow MADDecoder::header_mad_callback(void *data, struct mad_header const *header) {
+  // access object
+  MADDecoder *mad = static_cast<MADDecoder*>(data);
+  {
+    std::unique_lock<std::mutex> mlock(mad->parameters_mutex);
+    auto& p = mad->get_parameters();
+
+    // for simplicity we will always output stereo from this decoder
+    p.channels = 2;
+    p.bitrate_hz = header->bitrate;
+    p.samplerate_hz = header->samplerate;
+    p.source_channels = MAD_NCHANNELS(header);
+    p.layout = downmix_default_layout(p.source_channels);
+    mad->frames.set_samplerate(header->samplerate);
+  }
+  mad->parameters_updated_cv.notify_all();
+
+  // frames read before a trimmed loop rewound
+  if(mad->discard)
+    return MAD_FLOW_IGNORE;
+
+  // skip frames before range start without decoding them, the one right
+  // before start is still decoded to refill layer III bit reservoir
+  uint64_t length = 32*MAD_NSBSAMPLES(header);
+  if(mad->position + 2*length <= mad->start_frame) {
+    mad->position += length;
+    mad->reservoir_refill = true;
+    return MAD_FLOW_IGNORE;
+  }
+
   return MAD_FLOW_CONTINUE;
 }
 
@@ -63,11 +116,19 @@ enum mad_flow MADDecoder::input_mad_callback(void *data, struct mad_stream *stre
   MADDecoder *mad = static_cast<MADDecoder*>(data);
   auto& ifile = mad->ifile;
 
+  // mapped file is handed to mad in place, a window at a time
+  if(mad->mapping)
+    return mad->input_mapping(stream);
+
   size_t offset = sizeof(mad->buffer);
   size_t rem = 0;
 
-  // if next_frame is not null, next_frame mark start of next frame in current buffer
-  if(stream->next_frame) {
+  // if next_frame is not null, next_frame mark start of next frame in current
+  // buffer, data left is dropped when decoder rewound at end of range
+  if(mad->discard) {
+    mad->discard = false;
+  }
+  else if(stream->next_frame) {
     offset = stream->next_frame - mad->buffer;
     // compute length of remaining data in buffer
     rem = sizeof(mad->buffer) - offset;
@@ -92,6 +153,7 @@ enum mad_flow MADDecoder::input_mad_callback(void *data, struct mad_stream *stre
       // no data read
       if(mad->auto_rewind) {
         mad->rewind();
+        mad->loops++;
         // try again
       }
       else {
@@ -108,9 +170,38 @@ enum mad_flow MADDecoder::input_mad_callback(void *data, struct mad_stream *stre
   return MAD_FLOW_CONTINUE;
 }
 
-float MADDecoder::mad_sample_to_float(mad_fixed_t sample) {
+enum mad_flow MADDecoder::input_mapping(struct mad_stream *stream) {
+  size_t offset;
+  if(discard) {
+    // decoder rewound at end of range, data left is dropped
+    discard = false;
+    offset = mapping_offset;
+  }
+  else if(mapping_offset >= mapping_size) {
+    // whole file handed to mad already, what is left is no whole frame
+    if(!auto_rewind)
+      return MAD_FLOW_STOP;
+    rewind();
+    loops++;
+    offset = 0;
+  }
+  else {
+    // data left by mad is still in place
+    offset = stream->next_frame ? stream->next_frame - mapping : mapping_offset;
+  }
+
+  size_t size = std::min(MAPPING_WINDOW, mapping_size - offset);
+  mapping_offset = offset + size;
+  prefetch(mapping_offset);
+  mad_stream_buffer(stream, mapping + offset, size);
+
+  return MAD_FLOW_CONTINUE;
+}
+
+void MADDecoder::mad_samples_to_float(const mad_fixed_t *in, float *out, unsigned n) {
   const float factor = 1.0f/(1<<MAD_F_FRACBITS);
-  return std::min(1.0f, std::max(-1.0f, sample*factor));
+  for(unsigned i=0; i<n; i++)
+    out[i] = std::min(1.0f, std::max(-1.0f, in[i]*factor));
 }
 
 // member functions
@@ -118,29 +209,91 @@ MADDecoder::MADDecoder():
   buffer(),
   ifile(),
   filename(""),
+  mapping(NULL),
+  mapping_size(0),
+  mapping_offset(0),
+  frames(MAD_FRAME_FRAMES),
   quit(false),
-  eof(false) {
+  auto_rewind(false),
+  consumed(false),
+  start_frame(0),
+  end_frame(0),
+  position(0),
+  discard(false),
+  reservoir_refill(true),
+  decoded(false) {
 }
 
 MADDecoder::~MADDecoder() {
   // signal thread to quit
   quit = true;
-  frames_consumed_cv.notify_all();
+  frames.close();
 
   // wait for thread to quit
   join();
 
   // close file
   ifile.close();
+#ifndef _WIN32
+  if(mapping)
+    munmap((void*)mapping, mapping_size);
+#endif
 
   // close mad decoder
   mad_decoder_finish(&decoder);
 }
 
+bool MADDecoder::map_file(const std::string &_filename) {
+#ifndef _WIN32
+  int fd = ::open(_filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // mapping stays valid once descriptor is closed
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED)
+    return false;
+
+  // let kernel read ahead aggressively and drop pages behind us
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  mapping = static_cast<const unsigned char*>(p);
+  mapping_size = st.st_size;
+  mapping_offset = 0;
+  prefetch(0);
+  return true;
+#else
+  (void)_filename;
+  return false;
+#endif
+}
+
+void MADDecoder::prefetch(size_t offset) {
+#ifndef _WIN32
+  if(offset >= mapping_size)
+    return;
+  // madvise wants page aligned addresses
+  static const size_t page = sysconf(_SC_PAGESIZE);
+  size_t from = offset - offset % page;
+  size_t to = std::min(mapping_size, offset + MAPPING_WINDOW);
+  madvise((void*)(mapping + from), to - from, MADV_WILLNEED);
+#else
+  (void)offset;
+#endif
+}
+
 bool MADDecoder::open(std::string _filename) {
   filename = _filename;
 
-  {
+  if(!map_file(_filename)) {
+    // read file through stream buffer instead
     std::unique_lock<std::mutex> mlock(file_mutex);
 
     ifile.open(_filename, std::ifstream::binary);
@@ -164,78 +317,79 @@ bool MADDecoder::open(std::string _filename) {
 void MADDecoder::decode() {
   mad_decoder_run(&decoder, MAD_DECODER_MODE_SYNC);
   // eof reached
-  eof = true;
+  frames.set_end();
+
+  // file may hold no valid frame, start() must not wait for one anymore
+  {
+    std::unique_lock<std::mutex> mlock(parameters_mutex);
+    decoded = true;
+  }
+  parameters_updated_cv.notify_all();
 }
 
 void MADDecoder::start() {
   decoder_thread = std::make_unique<std::thread>(&MADDecoder::decode, this);
 
-  // wait for parameters to be valid
-  {
-    std::unique_lock<std::mutex> mlock(parameters_mutex);
-    parameters_updated_cv.wait(mlock);
-  }
+  // wait for parameters to be valid, first header may have been read
+  // already
+  std::unique_lock<std::mutex> mlock(parameters_mutex);
+  parameters_updated_cv.wait(mlock, [this]() {
+    return get_parameters().samplerate_hz > 0 || decoded;
+  });
 }
 
 void MADDecoder::rewind() {
+  reservoir_refill = true;
+
+  // rewinding a mapped file only moves back to its start
+  if(mapping) {
+    mapping_offset = 0;
+    position = 0;
+    return;
+  }
+
   // rewing to start of file
+  std::unique_lock<std::mutex> mlock(file_mutex);
   ifile.clear();
   ifile.seekg(0, std::ifstream::beg);
+  position = 0;
 }
 
 void MADDecoder::set_auto_rewind(bool b) {
   auto_rewind = b;
 }
 
+void MADDecoder::set_range(uint64_t start, uint64_t end) {
+  start_frame = start;
+  // empty range would never produce a frame
+  end_frame = end > start ? end : 0;
+}
+
 void MADDecoder::join() {
   if(decoder_thread)
     decoder_thread->join();
 }
 
-void MADDecoder::wait_for_space_available(void) {
-  // acquire frames mutex
-  std::unique_lock<std::mutex> mlock(frames_mutex);
-
-  while(frames.size() >= max_frames) {
-    // wait for notification of changes in queue
-    frames_consumed_cv.wait(mlock);
-    // check quit
-    if(quit)
-      return;
-  }
+void MADDecoder::set_block_frames(unsigned n) {
+  frames.set_block_frames(n);
 }
 
-std::vector<audio_frame_t> MADDecoder::pop_frames(unsigned int n) {
-  std::vector<audio_frame_t> out;
-
-  {
-    std::unique_lock<std::mutex> mlock(frames_mutex);
-    bool poped=false;
-    while(n--) {
-
-      while(frames.empty()) {
-        if(eof)
-          return out;
-        // notify frames consumed
-        if(poped) {
-          frames_consumed_cv.notify_all();
-          poped = false;
-        }
-        // not enough frames in queue, sleep on it
-        frames_available_cv.wait(mlock);
-      }
-
-      out.push_back(frames.front());
-      frames.pop();
-      poped = true;
-    }
-    // some frames consumed
-    frames_consumed_cv.notify_all();
-  }
+unsigned MADDecoder::pop_frames(float *left, float *right, unsigned n) {
+  return frames.pop(left, right, n);
+}
 
-  return out;
+unsigned MADDecoder::try_pop_frames(float *left, float *right, unsigned n, bool &end) {
+  unsigned got = frames.try_pop(left, right, n);
+  end = got < n && frames.is_drained();
+  // decoder fell behind consumer
+  if(got < n && !end && consumed)
+    underruns++;
+  if(got > 0)
+    consumed = true;
+  return got;
 }
 
 void MADDecoder::exit() {
   quit = true;
+  frames.close();
 }
@@ -8,10 +8,10 @@
 #include <vector>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
 #include <atomic>
 
 #include "decoder.hpp"
+#include "framequeue.hpp"
 
 class MADDecoder: public Decoder {
 
@@ -31,11 +31,14 @@ class MADDecoder: public Decoder {
     // if set to true, will rewind at eof
     void set_auto_rewind(bool);
 
-    // wait until queue is not full
-    void wait_for_space_available(void);
+    void set_range(uint64_t start, uint64_t end);
 
     // pop at most n audio frames from decoder
-    std::vector<audio_frame_t> pop_frames(unsigned int n);
+    unsigned pop_frames(float *left, float *right, unsigned n);
+
+    unsigned try_pop_frames(float *left, float *right, unsigned n, bool &end);
+
+    void set_block_frames(unsigned);
 
     void exit(void);
 
@@ -51,10 +54,19 @@ class MADDecoder: public Decoder {
 
     static enum mad_flow input_mad_callback(void *data, struct mad_stream *stream);
 
+    // feed mad from mapped file
+    enum mad_flow input_mapping(struct mad_stream *stream);
+
+    // map whole file in memory, return false if it cannot be mapped
+    bool map_file(const std::string &filename);
+
+    // ask kernel to read window starting at offset of mapped file
+    void prefetch(size_t offset);
+
     void decode(void);
 
-    // convert mad sample to float
-    static float mad_sample_to_float(mad_fixed_t sample);
+    // convert n mad samples to floats
+    static void mad_samples_to_float(const mad_fixed_t *in, float *out, unsigned n);
 
     // internal buffer for file read
     unsigned char buffer[4096];
@@ -62,6 +74,14 @@ class MADDecoder: public Decoder {
     // mp3 input file
     std::ifstream ifile;
     std::string filename;
+
+    // whole file mapped in memory, null when file is read through ifile
+    const unsigned char *mapping;
+    size_t mapping_size;
+    // end of data handed to mad so far
+    size_t mapping_offset;
+    // data handed to mad at once, next window is prefetched meanwhile
+    static const size_t MAPPING_WINDOW = 256*1024;
     
     // mad decoder structure
     struct mad_decoder decoder;
@@ -69,16 +89,13 @@ class MADDecoder: public Decoder {
     // thread running mad decoder
     std::unique_ptr<std::thread> decoder_thread;
 
-    // maximum number of stored frames
-    const unsigned max_frames = 1024;
-    // internal decoded frames queue
-    std::queue<audio_frame_t> frames;
-    // associated mutex
-    std::mutex frames_mutex;
-    // associated condition variable with new frames in queue
-    std::condition_variable frames_available_cv;
-    // associated condition variable with new frames consumed from queue
-    std::condition_variable frames_consumed_cv;
+    // largest mad frame
+    static const unsigned MAD_FRAME_FRAMES = 1152;
+    // decoded frames queue, a whole mad frame is pushed at once
+    FrameQueue frames;
+    // mad frame converted to floats before it is queued, decoder thread only
+    float frame_left[MAD_FRAME_FRAMES];
+    float frame_right[MAD_FRAME_FRAMES];
 
     // associated condition variable with parameters updated
     std::mutex parameters_mutex;
@@ -89,10 +106,23 @@ class MADDecoder: public Decoder {
 
     // thread will try to quit when true
     std::atomic<bool> quit;
-    // end of file reached
-    std::atomic<bool> eof;
     // rewind at end of file
     std::atomic<bool> auto_rewind;
+    // frames were popped already, missing first frames is no underrun
+    bool consumed;
+
+    // decoded range, in frames
+    uint64_t start_frame;
+    uint64_t end_frame;
+    // frames decoded or skipped since last rewind
+    std::atomic<uint64_t> position;
+    // drop what is left of stream buffer after rewinding at end of range
+    std::atomic<bool> discard;
+    // no frame decoded since start, last rewind or skip, layer III frames
+    // may refer to bit reservoir data never read
+    std::atomic<bool> reservoir_refill;
+    // decoder thread is done, parameters mutex held
+    bool decoded;
 };
 
 #endif
@@ -0,0 +1,196 @@
+#include "midiinput.hpp"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+#include <alsa/asoundlib.h>
+#endif
+
+MidiInput::MidiInput(std::shared_ptr<AudioMixer> mixer)
+  :mixer(mixer),
+  seq(NULL),
+  port(-1),
+  queue(-1),
+  quit(false) {
+
+  for(int i=0; i<NOTES; i++) {
+    notes[i] = 0;
+    gates[i] = false;
+    ccs[i] = 0;
+  }
+}
+
+MidiInput::~MidiInput() {
+  exit();
+  join();
+
+#ifdef __linux__
+  if(seq) {
+    if(queue >= 0)
+      snd_seq_free_queue(seq, queue);
+    snd_seq_close(seq);
+  }
+#endif
+}
+
+bool MidiInput::open(const std::string &name) {
+#ifdef __linux__
+  auto err = snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK);
+  if(err < 0) {
+    std::cerr<<"snd_seq_open error "<<snd_strerror(err)<<"\n";
+    seq = NULL;
+    return false;
+  }
+  snd_seq_set_client_name(seq, name.c_str());
+
+  // queue used to timestamp incoming events
+  queue = snd_seq_alloc_named_queue(seq, name.c_str());
+  if(queue < 0) {
+    std::cerr<<"snd_seq_alloc_named_queue error "<<snd_strerror(queue)<<"\n";
+    return false;
+  }
+
+  snd_seq_port_info_t *pinfo;
+  snd_seq_port_info_malloc(&pinfo);
+  snd_seq_port_info_set_name(pinfo, "pads");
+  snd_seq_port_info_set_capability(pinfo,
+    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+  snd_seq_port_info_set_type(pinfo,
+    SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+  snd_seq_port_info_set_timestamping(pinfo, 1);
+  snd_seq_port_info_set_timestamp_real(pinfo, 1);
+  snd_seq_port_info_set_timestamp_queue(pinfo, queue);
+  err = snd_seq_create_port(seq, pinfo);
+  port = snd_seq_port_info_get_port(pinfo);
+  snd_seq_port_info_free(pinfo);
+  if(err < 0) {
+    std::cerr<<"snd_seq_create_port error "<<snd_strerror(err)<<"\n";
+    return false;
+  }
+
+  snd_seq_start_queue(seq, queue, NULL);
+  snd_seq_drain_output(seq);
+
+  return true;
+#else
+  (void)name;
+  return false;
+#endif
+}
+
+void MidiInput::start(void) {
+  if(!seq || port < 0 || input_thread)
+    return;
+  input_thread = std::make_unique<std::thread>(&MidiInput::run, this);
+}
+
+void MidiInput::exit(void) {
+  quit = true;
+}
+
+void MidiInput::join(void) {
+  if(input_thread) {
+    input_thread->join();
+    input_thread.reset();
+  }
+}
+
+void MidiInput::bind_note(int note, AudioPlayerID id, bool gate) {
+  if(note < 0 || note >= NOTES)
+    return;
+  notes[note] = id;
+  gates[note] = gate;
+}
+
+void MidiInput::bind_cc(int cc, AudioPlayerID id) {
+  if(cc < 0 || cc >= NOTES)
+    return;
+  ccs[cc] = id;
+}
+
+void MidiInput::unbind(AudioPlayerID id) {
+  for(int i=0; i<NOTES; i++) {
+    if(notes[i] == id)
+      notes[i] = 0;
+    if(ccs[i] == id)
+      ccs[i] = 0;
+  }
+}
+
+double MidiInput::get_queue_time(void) {
+#ifdef __linux__
+  snd_seq_queue_status_t *status;
+  snd_seq_queue_status_malloc(&status);
+  snd_seq_get_queue_status(seq, queue, status);
+  auto rt = snd_seq_queue_status_get_real_time(status);
+  double t = rt->tv_sec + rt->tv_nsec*1e-9;
+  snd_seq_queue_status_free(status);
+  return t;
+#else
+  return 0.0;
+#endif
+}
+
+void MidiInput::run(void) {
+#ifdef __linux__
+  int npfds = snd_seq_poll_descriptors_count(seq, POLLIN);
+  std::vector<struct pollfd> pfds(npfds);
+  snd_seq_poll_descriptors(seq, pfds.data(), npfds, POLLIN);
+
+  while(!quit) {
+    // wake up regularly to check quit
+    if(poll(pfds.data(), npfds, 100) <= 0)
+      continue;
+
+    // map sequencer clock to output stream clock once per wakeup
+    double queue_time = get_queue_time();
+    double stream_time = mixer->get_stream_time();
+
+    AudioMixerCommands batch;
+    snd_seq_event_t *ev;
+    while(snd_seq_event_input(seq, &ev) >= 0) {
+      // event age, it may have waited in sequencer before we got woken up
+      double age = 0.0;
+      if((ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL) {
+        double t = ev->time.time.tv_sec + ev->time.time.tv_nsec*1e-9;
+        age = std::max(0.0, queue_time - t);
+      }
+      uint64_t frame = mixer->get_schedule_frame(stream_time - age);
+
+      switch(ev->type) {
+
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF: {
+          int note = ev->data.note.note;
+          if(note >= NOTES || notes[note] == 0)
+            break;
+          AudioPlayerID id = notes[note];
+          // note on with null velocity is a note off
+          bool on = ev->type == SND_SEQ_EVENT_NOTEON && ev->data.note.velocity > 0;
+          if(on)
+            mixer->collect_trigger(id, -1, batch, frame);
+          else if(gates[note])
+            mixer->collect_stop(id, -1, batch, frame);
+          break;
+        }
+
+        case SND_SEQ_EVENT_CONTROLLER: {
+          unsigned cc = ev->data.control.param;
+          if(cc >= (unsigned)NOTES || ccs[cc] == 0)
+            break;
+          float gain = std::min(127, std::max(0, ev->data.control.value))/127.0f;
+          batch.push_back({MIXER_COMMAND_GAIN, ccs[cc], gain, frame});
+          break;
+        }
+
+        default:
+          break;
+      }
+    }
+
+    mixer->post(batch);
+  }
+#endif
+}
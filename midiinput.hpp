@@ -0,0 +1,68 @@
+#ifndef _MIDIINPUT_HPP
+#define _MIDIINPUT_HPP
+
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <string>
+
+#include "audiomixer.hpp"
+
+struct _snd_seq;
+
+// ALSA sequencer input port mapping MIDI notes and controllers to players.
+// Events are timestamped by the sequencer and posted straight to the mixer
+// command queue at the frame matching their arrival time, never through the
+// gui thread. Only available on Linux, open() fails elsewhere.
+class MidiInput {
+
+  public:
+    explicit MidiInput(std::shared_ptr<AudioMixer> mixer);
+    ~MidiInput();
+
+    // create sequencer client and its input port
+    bool open(const std::string &name);
+
+    void start(void);
+
+    void exit(void);
+
+    void join(void);
+
+    // note on triggers player, note off stops it when gate is set
+    void bind_note(int note, AudioPlayerID id, bool gate);
+
+    // controller sets player gain
+    void bind_cc(int cc, AudioPlayerID id);
+
+    // remove all bindings of player
+    void unbind(AudioPlayerID id);
+
+    static const int NOTES = 128;
+
+  private:
+
+    void run(void);
+
+    // current time of sequencer queue, in seconds
+    double get_queue_time(void);
+
+    std::shared_ptr<AudioMixer> mixer;
+
+    struct _snd_seq *seq;
+    int port;
+    int queue;
+
+    // player bound to each note and controller, 0 if none
+    std::array<std::atomic<AudioPlayerID>, NOTES> notes;
+    std::array<std::atomic<bool>, NOTES> gates;
+    std::array<std::atomic<AudioPlayerID>, NOTES> ccs;
+
+    std::unique_ptr<std::thread> input_thread;
+
+    // thread will try to quit when true
+    std::atomic<bool> quit;
+};
+
+#endif//_MIDIINPUT_HPP
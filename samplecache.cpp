@@ -0,0 +1,179 @@
+#include "samplecache.hpp"
+#include "decoder.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+// half float exponent bias is 15 where float one is 127
+static const float HALF_TO_FLOAT = std::ldexp(1.0f, 112);
+static const float FLOAT_TO_HALF = std::ldexp(1.0f, -112);
+
+static uint32_t float_bits(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+static float bits_float(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static uint16_t float_to_half(float f) {
+  uint32_t sign = (float_bits(f) >> 16) & 0x8000;
+  // rebias exponent, values too small for a normal half become float
+  // denormals whose top mantissa bits are the half denormal
+  uint32_t x = float_bits(std::fabs(f)*FLOAT_TO_HALF);
+  // round to nearest, clamp to largest finite half
+  uint32_t h = std::min<uint32_t>((x + 0x1000) >> 13, 0x7bff);
+  return sign | h;
+}
+
+static uint16_t float_to_int16(float f) {
+  return (int16_t)std::lrint(std::min(1.0f, std::max(-1.0f, f))*32767);
+}
+
+// conversions below have no branch so loops over them vectorize
+
+static void half_to_float(const uint16_t *in, float *out, unsigned n) {
+  for(unsigned i=0; i<n; i++) {
+    uint32_t h = in[i];
+    float v = bits_float((h & 0x7fff) << 13)*HALF_TO_FLOAT;
+    out[i] = bits_float(float_bits(v) | (h & 0x8000) << 16);
+  }
+}
+
+static void int16_to_float(const uint16_t *in, float *out, unsigned n) {
+  const float factor = 1.0f/32768;
+  for(unsigned i=0; i<n; i++)
+    out[i] = (int16_t)in[i]*factor;
+}
+
+CachedSamples::CachedSamples()
+  :format(SAMPLE_FORMAT_INT16),
+  samplerate_hz(0),
+  frames(0),
+  channels(2),
+  source_channels(2),
+  layout(CHANNEL_LAYOUT_STEREO) {
+}
+
+void CachedSamples::expand(uint64_t from, unsigned n, float *l, float *r) const {
+  auto widen = [this](const uint16_t *in, float *out, unsigned n) {
+    if(format == SAMPLE_FORMAT_HALF)
+      half_to_float(in, out, n);
+    else
+      int16_to_float(in, out, n);
+  };
+
+  widen(left.data() + from, l, n);
+  if(channels == 2)
+    widen(right.data() + from, r, n);
+  else
+    std::copy(l, l + n, r);
+}
+
+size_t CachedSamples::get_size(void) const {
+  return (left.size() + right.size())*sizeof(uint16_t);
+}
+
+SampleCache::SampleCache(SampleFormat format, double max_seconds, size_t max_bytes)
+  :format(format),
+  max_seconds(max_seconds),
+  max_bytes(max_bytes),
+  size(0),
+  pool(1) {
+}
+
+SampleCache::~SampleCache() {
+}
+
+std::shared_ptr<const CachedSamples> SampleCache::get(const std::string &filename) {
+  std::unique_lock<std::mutex> mlock(results_mutex);
+
+  auto it = results.find(filename);
+  if(it != results.end())
+    return it->second;
+
+  if(max_seconds > 0 && scheduled.insert(filename).second)
+    pool.push([this, filename]() { load(filename); });
+
+  return nullptr;
+}
+
+size_t SampleCache::get_size(void) {
+  return size;
+}
+
+void SampleCache::load(const std::string &filename) {
+  auto samples = std::make_shared<CachedSamples>();
+
+  // file stays scheduled on failure so it is not decoded over and over
+  if(!decode(filename, *samples))
+    return;
+
+  std::unique_lock<std::mutex> mlock(results_mutex);
+  if(size + samples->get_size() > max_bytes) {
+    std::cerr<<"sample cache full, streaming "<<filename<<"\n";
+    return;
+  }
+  size += samples->get_size();
+  results[filename] = samples;
+}
+
+bool SampleCache::decode(const std::string &filename, CachedSamples &samples) {
+  auto decoder = Decoder::create(filename);
+  if(!decoder)
+    return false;
+  decoder->set_auto_rewind(false);
+  if(!decoder->open(filename))
+    return false;
+  decoder->start();
+
+  samples.format = format;
+  samples.samplerate_hz = decoder->get_parameters().samplerate_hz;
+  samples.source_channels = decoder->get_parameters().source_channels;
+  samples.layout = decoder->get_parameters().layout;
+  const uint64_t max_frames = max_seconds*samples.samplerate_hz;
+
+  const unsigned CHUNK_FRAMES = 4096;
+  std::vector<float> left(CHUNK_FRAMES), right(CHUNK_FRAMES);
+  auto narrow = format == SAMPLE_FORMAT_HALF ? float_to_half : float_to_int16;
+  // gathered on heap, moved to arena at once when size is known
+  std::vector<uint16_t> left_samples, right_samples;
+  bool mono = true;
+  while(1) {
+    unsigned n = decoder->pop_frames(left.data(), right.data(), CHUNK_FRAMES);
+    if(n == 0)
+      break;
+
+    // too long to be cached, it will keep being streamed
+    if(pool.is_quitting() || samples.frames + n > max_frames) {
+      decoder->exit();
+      decoder->join();
+      return false;
+    }
+
+    for(unsigned i=0; i<n; i++) {
+      left_samples.push_back(narrow(left[i]));
+      right_samples.push_back(narrow(right[i]));
+    }
+    mono = mono && std::equal(left.begin(), left.begin() + n, right.begin());
+    samples.frames += n;
+  }
+
+  decoder->exit();
+  decoder->join();
+
+  // identical channels are stored once
+  samples.left.assign(left_samples.begin(), left_samples.end());
+  if(mono)
+    samples.channels = 1;
+  else
+    samples.right.assign(right_samples.begin(), right_samples.end());
+
+  return samples.frames > 0;
+}
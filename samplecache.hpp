@@ -0,0 +1,92 @@
+#ifndef _SAMPLECACHE_HPP
+#define _SAMPLECACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "threadpool.hpp"
+#include "decoder.hpp"
+#include "audioarena.hpp"
+
+// storage of cached samples, both 16 bits per sample
+enum SampleFormat {
+  // signed 16 bits integer, 96 dB of dynamic range
+  SAMPLE_FORMAT_INT16 = 1,
+  // IEEE 754 half float, keeps low level passages at full resolution
+  SAMPLE_FORMAT_HALF,
+};
+
+// whole file decoded to planar 16 bits samples, immutable once published
+class CachedSamples {
+
+  public:
+    CachedSamples();
+
+    // widen n frames starting at frame from to float
+    void expand(uint64_t from, unsigned n, float *left, float *right) const;
+
+    // memory used by samples
+    size_t get_size(void) const;
+
+    // metadata, format is chosen by cache when file is decoded
+    SampleFormat format;
+    int samplerate_hz;
+    uint64_t frames;
+    // 1 when both channels were identical and right one is not stored
+    int channels;
+    // as found in decoded file
+    int source_channels;
+    ChannelLayout layout;
+
+    ArenaVector<uint16_t> left;
+    ArenaVector<uint16_t> right;
+};
+
+// keep short files decoded in memory so players start them without any
+// disk access. Files are decoded on a background thread the first time they
+// are asked for, files too long or over memory budget stay streamed.
+class SampleCache {
+
+  public:
+    // files up to max_seconds long are cached, as long as all cached files
+    // fit in max_bytes
+    SampleCache(SampleFormat format, double max_seconds, size_t max_bytes);
+    ~SampleCache();
+
+    // return samples of file if cached, schedule decoding and return null
+    // otherwise, never blocks
+    std::shared_ptr<const CachedSamples> get(const std::string &filename);
+
+    // memory used by all cached files
+    size_t get_size(void);
+
+  private:
+
+    // run from pool thread
+    void load(const std::string &filename);
+
+    // decode whole file, return false on error, when file is too long or
+    // when pool is quitting
+    bool decode(const std::string &filename, CachedSamples &samples);
+
+    const SampleFormat format;
+    const double max_seconds;
+    const size_t max_bytes;
+
+    std::map<std::string, std::shared_ptr<const CachedSamples>> results;
+    // files queued, being decoded or not cacheable
+    std::set<std::string> scheduled;
+    std::mutex results_mutex;
+    std::atomic<size_t> size;
+
+    // declared last so worker is joined before anything else is destroyed
+    ThreadPool pool;
+};
+
+#endif//_SAMPLECACHE_HPP
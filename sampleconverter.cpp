@@ -0,0 +1,118 @@
+#include "sampleconverter.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+const unsigned SampleConverter::LANES;
+const unsigned SampleConverter::BLOCK;
+
+const char *output_format_name(OutputFormat format) {
+  switch(format) {
+    case OUTPUT_FORMAT_AUTO: return "Auto";
+    case OUTPUT_FORMAT_FLOAT32: return "32 bits float";
+    case OUTPUT_FORMAT_INT32: return "32 bits integer";
+    case OUTPUT_FORMAT_INT24: return "24 bits integer";
+    case OUTPUT_FORMAT_INT16: return "16 bits integer";
+  }
+  return "";
+}
+
+size_t output_format_size(OutputFormat format) {
+  switch(format) {
+    case OUTPUT_FORMAT_INT24: return 3;
+    case OUTPUT_FORMAT_INT16: return 2;
+    default: return 4;
+  }
+}
+
+SampleConverter::SampleConverter()
+  :format(OUTPUT_FORMAT_FLOAT32) {
+
+  // xorshift state must never be 0
+  for(unsigned j=0; j<LANES; j++)
+    noise_state[j] = 0x9e3779b9u*(j + 1);
+}
+
+void SampleConverter::set_format(OutputFormat f) {
+  format = f == OUTPUT_FORMAT_AUTO ? OUTPUT_FORMAT_FLOAT32 : f;
+}
+
+OutputFormat SampleConverter::get_format(void) {
+  return format;
+}
+
+void SampleConverter::quantize(const float *in, int32_t *out, unsigned n, float scale) {
+  // triangular noise spanning one step either side, sum of two uniform draws
+  float noise[BLOCK];
+  for(unsigned i=0; i<n; i+=LANES) {
+    for(unsigned j=0; j<LANES; j++) {
+      uint32_t a = noise_state[j];
+      a ^= a << 13; a ^= a >> 17; a ^= a << 5;
+      uint32_t b = a;
+      b ^= b << 13; b ^= b >> 17; b ^= b << 5;
+      noise_state[j] = b;
+      noise[i + j] = ((int32_t)(a >> 8) - (int32_t)(b >> 8))*(1.0f/16777216);
+    }
+  }
+
+  // round half away from zero, clamped to integer range
+  for(unsigned i=0; i<n; i++) {
+    float v = std::min(scale - 1.0f, std::max(-scale, in[i]*scale + noise[i]));
+    out[i] = (int32_t)(v + (v >= 0.0f ? 0.5f : -0.5f));
+  }
+}
+
+void SampleConverter::interleave(const float *left, const float *right, void *out, unsigned long n) {
+  if(format == OUTPUT_FORMAT_FLOAT32) {
+    float *o = static_cast<float*>(out);
+    for(unsigned long i=0; i<n; i++) {
+      o[2*i] = left[i];
+      o[2*i+1] = right[i];
+    }
+    return;
+  }
+
+  if(format == OUTPUT_FORMAT_INT32) {
+    // float carries 24 bits only, dither at 32 bits would be lost
+    const float scale = 2147483648.0f;
+    const float top = 2147483520.0f;
+    int32_t *o = static_cast<int32_t*>(out);
+    for(unsigned long i=0; i<n; i++) {
+      o[2*i] = (int32_t)std::min(top, std::max(-scale, left[i]*scale));
+      o[2*i+1] = (int32_t)std::min(top, std::max(-scale, right[i]*scale));
+    }
+    return;
+  }
+
+  const float scale = format == OUTPUT_FORMAT_INT24 ? 8388608.0f : 32768.0f;
+  int32_t ql[BLOCK], qr[BLOCK];
+  for(unsigned long i=0; i<n; i+=BLOCK) {
+    unsigned m = std::min<unsigned long>(BLOCK, n - i);
+    quantize(left + i, ql, m, scale);
+    quantize(right + i, qr, m, scale);
+
+    if(format == OUTPUT_FORMAT_INT16) {
+      int16_t *o = static_cast<int16_t*>(out) + 2*i;
+      for(unsigned k=0; k<m; k++) {
+        o[2*k] = ql[k];
+        o[2*k+1] = qr[k];
+      }
+    }
+    else {
+      // packed little endian
+      unsigned char *o = static_cast<unsigned char*>(out) + 6*i;
+      for(unsigned k=0; k<m; k++) {
+        o[6*k] = ql[k];
+        o[6*k+1] = ql[k] >> 8;
+        o[6*k+2] = ql[k] >> 16;
+        o[6*k+3] = qr[k];
+        o[6*k+4] = qr[k] >> 8;
+        o[6*k+5] = qr[k] >> 16;
+      }
+    }
+  }
+}
+
+void SampleConverter::silence(void *out, unsigned long n) {
+  memset(out, 0, 2*n*output_format_size(format));
+}
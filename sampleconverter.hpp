@@ -0,0 +1,54 @@
+#ifndef _SAMPLECONVERTER_HPP
+#define _SAMPLECONVERTER_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+// sample format of output stream
+enum OutputFormat {
+  // 32 bits float, leaving any conversion to host API
+  OUTPUT_FORMAT_AUTO = 0,
+  OUTPUT_FORMAT_FLOAT32,
+  OUTPUT_FORMAT_INT32,
+  // packed 3 bytes
+  OUTPUT_FORMAT_INT24,
+  OUTPUT_FORMAT_INT16,
+};
+
+const char *output_format_name(OutputFormat);
+
+// bytes of one sample of given format
+size_t output_format_size(OutputFormat);
+
+// interleave planar stereo into output stream buffer. Floats are narrowed
+// to integers with TPDF dither, noise comes from independent generators so
+// conversion loops vectorize. Owned by a single stream callback.
+class SampleConverter {
+
+  public:
+    SampleConverter();
+
+    void set_format(OutputFormat);
+    OutputFormat get_format(void);
+
+    void interleave(const float *left, const float *right, void *out, unsigned long n);
+
+    // fill n frames of output buffer with silence
+    void silence(void *out, unsigned long n);
+
+  private:
+
+    // convert up to BLOCK samples to integers of given full scale,
+    // dithered at one least significant bit
+    void quantize(const float *in, int32_t *out, unsigned n, float scale);
+
+    static const unsigned LANES = 8;
+    static const unsigned BLOCK = 256;
+
+    OutputFormat format;
+
+    // one xorshift generator per lane
+    uint32_t noise_state[LANES];
+};
+
+#endif//_SAMPLECONVERTER_HPP
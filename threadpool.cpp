@@ -0,0 +1,51 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned nthreads)
+  :quit(false) {
+
+  if(nthreads == 0)
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+  for(unsigned i=0; i<nthreads; i++)
+    threads.emplace_back(&ThreadPool::run, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> mlock(tasks_mutex);
+    quit = true;
+    tasks = std::queue<std::function<void()>>();
+    tasks_available_cv.notify_all();
+  }
+
+  for(auto& thread: threads)
+    thread.join();
+}
+
+void ThreadPool::push(std::function<void()> task) {
+  std::unique_lock<std::mutex> mlock(tasks_mutex);
+  tasks.push(task);
+  tasks_available_cv.notify_one();
+}
+
+bool ThreadPool::is_quitting(void) {
+  return quit;
+}
+
+void ThreadPool::run(void) {
+  while(1) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> mlock(tasks_mutex);
+      while(tasks.empty() && !quit)
+        tasks_available_cv.wait(mlock);
+      if(quit)
+        return;
+      task = tasks.front();
+      tasks.pop();
+    }
+    task();
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef _THREADPOOL_HPP
+#define _THREADPOOL_HPP
+
+#include <thread>
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// fixed set of worker threads running background tasks in push order
+class ThreadPool {
+
+  public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(unsigned nthreads = 0);
+
+    // drop tasks not started yet and wait for running ones
+    ~ThreadPool();
+
+    void push(std::function<void()> task);
+
+    // long running tasks should give up when true
+    bool is_quitting(void);
+
+  private:
+
+    void run(void);
+
+    std::vector<std::thread> threads;
+
+    std::queue<std::function<void()>> tasks;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_available_cv;
+
+    // workers will try to quit when true
+    std::atomic<bool> quit;
+};
+
+#endif//_THREADPOOL_HPP
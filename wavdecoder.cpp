@@ -1,17 +1,31 @@
 
 #include "wavdecoder.hpp"
+#include "downmix.hpp"
 
 #include <iostream>
-#include <memory>
+#include <algorithm>
+
+const unsigned WAVDecoder::READ_FRAMES;
 
 WAVDecoder::WAVDecoder() :
   sfinfo({0}),
   sffile(NULL),
-  auto_rewind(false) {
+  read_left(READ_FRAMES),
+  read_right(READ_FRAMES),
+  frames(READ_FRAMES),
+  quit(false),
+  consumed(false),
+  auto_rewind(false),
+  start_frame(0),
+  end_frame(0),
+  position(0) {
 
 }
 
 WAVDecoder::~WAVDecoder() {
+  // signal thread to quit and wait for it
+  exit();
+  join();
 
   if(sffile) {
     sf_close(sffile);
@@ -31,73 +45,121 @@ bool WAVDecoder::open(std::string _filename) {
     return false;
   }
 
+  // speaker positions stored in file if any, WAVE order otherwise
+  std::vector<int> positions(sfinfo.channels);
+  if(sf_command(sffile, SFC_GET_CHANNEL_MAP_INFO, positions.data(),
+      positions.size()*sizeof(int)) != SF_TRUE)
+    positions.clear();
+
+  std::vector<float> gl, gr;
+  if(!downmix_matrix(sfinfo.channels, positions, gl, gr)) {
+    std::cerr<<"unsupported channel map in "<<filename<<", using default\n";
+    downmix_matrix(sfinfo.channels, std::vector<int>(), gl, gr);
+  }
+  gains_left.assign(gl.begin(), gl.end());
+  gains_right.assign(gr.begin(), gr.end());
+
   // fill parameters structure
   auto &p = get_parameters();
   p.channels = 2;
   p.samplerate_hz = sfinfo.samplerate;
   p.bitrate_hz = 0;
+  p.source_channels = sfinfo.channels;
+  p.layout = downmix_default_layout(sfinfo.channels);
+  frames.set_samplerate(sfinfo.samplerate);
+  interleaved.resize((size_t)READ_FRAMES*sfinfo.channels);
 
   return true;
 }
 
 void WAVDecoder::start(void) {
-  return;
+  // jump over skipped frames
+  if(start_frame > 0)
+    rewind();
+
+  reader_thread = std::make_unique<std::thread>(&WAVDecoder::read, this);
 }
 
 void WAVDecoder::join(void) {
-  return;
+  if(reader_thread && reader_thread->joinable())
+    reader_thread->join();
 }
 
 void WAVDecoder::exit(void) {
-  return;
+  quit = true;
+  frames.close();
 }
 
 void WAVDecoder::rewind(void) {
   if(sffile == NULL)
     return;
-  sf_seek(sffile, 0, SEEK_SET);
+  sf_seek(sffile, start_frame, SEEK_SET);
+  position = start_frame;
 }
 
 void WAVDecoder::set_auto_rewind(bool b) {
   auto_rewind = b;
 }
 
-std::vector<audio_frame_t> WAVDecoder::pop_frames(unsigned int nframes) {
+void WAVDecoder::set_range(uint64_t start, uint64_t end) {
+  start_frame = start;
+  // empty range would never produce a frame
+  end_frame = end > start ? end : 0;
+}
 
+void WAVDecoder::read(void) {
   const int nchannels = sfinfo.channels;
-  int rsamples = nframes * nchannels;
-  auto buffer = std::make_unique<float[]>(rsamples);
+  // range yields no frame when it starts past end of file
+  bool empty = true;
 
-  std::vector<audio_frame_t> out;
-  sf_count_t rsz = 0;
-  while(1) {
-    rsz = sf_readf_float(sffile, buffer.get(), nframes);
+  while(!quit && frames.wait_for_space()) {
+    // do not read past end of range
+    sf_count_t rframes = READ_FRAMES;
+    if(end_frame > 0)
+      rframes = std::min<sf_count_t>(rframes, end_frame > position ? end_frame - position : 0);
+
+    sf_count_t rsz = rframes > 0 ? sf_readf_float(sffile, interleaved.data(), rframes) : 0;
     if(rsz > 0) {
+      position += rsz;
+      empty = false;
+      // split channels, mixing down or up to stereo
+      downmix(interleaved.data(), nchannels, gains_left.data(), gains_right.data(),
+        read_left.data(), read_right.data(), rsz);
+      frames.push(read_left.data(), read_right.data(), rsz);
+    }
+    else if(rframes > 0 && sf_error(sffile) != SF_ERR_NO_ERROR) {
+      // unreadable data, give up instead of rewinding forever
+      errors++;
       break;
     }
+    else if(auto_rewind && !empty) {
+      rewind();
+      empty = true;
+      loops++;
+    }
     else {
-      if(auto_rewind) {
-        rewind();
-      }
-      else {
-        return {};
-      }
+      break;
     }
   }
 
-  for(int i=0;i<rsz;i++) {
-    auto k = i*nchannels;
-    float sl,sr;
-
-    sl = buffer[k];
+  frames.set_end();
+}
 
-    if (nchannels == 1)
-      sr = sl;
-    else
-      sr = buffer[k+1];
+unsigned WAVDecoder::pop_frames(float *left, float *right, unsigned n) {
+  return frames.pop(left, right, n);
+}
 
-    out.push_back({sl,sr});
-  }
+unsigned WAVDecoder::try_pop_frames(float *left, float *right, unsigned n, bool &end) {
+  unsigned got = frames.try_pop(left, right, n);
+  end = got < n && frames.is_drained();
+  // reader fell behind consumer
+  if(got < n && !end && consumed)
+    underruns++;
+  if(got > 0)
+    consumed = true;
+  return got;
+}
 
-  return out;
+void WAVDecoder::set_block_frames(unsigned n) {
+  frames.set_block_frames(n);
 }
@@ -4,8 +4,13 @@
 #include "sndfile.h"
 
 #include "decoder.hpp"
+#include "audioarena.hpp"
+#include "framequeue.hpp"
 
 #include <atomic>
+#include <vector>
+#include <thread>
+#include <memory>
 
 class WAVDecoder : public Decoder {
 
@@ -25,19 +30,54 @@ class WAVDecoder : public Decoder {
 
     void set_auto_rewind(bool);
 
-    void wait_for_space_available(void);
+    void set_range(uint64_t start, uint64_t end);
 
-    std::vector<audio_frame_t> pop_frames(unsigned int n);
+    unsigned pop_frames(float *left, float *right, unsigned n);
+
+    unsigned try_pop_frames(float *left, float *right, unsigned n, bool &end);
+
+    void set_block_frames(unsigned);
 
   private:
 
+    // run by reader thread, reads file ahead of consumer into queue
+    void read(void);
+
+    // frames read from file at once
+    static const unsigned READ_FRAMES = 1024;
+
     std::string filename;
 
     SF_INFO sfinfo;
 
     SNDFILE *sffile;
 
+    // interleaved samples read from file and their split into channels,
+    // reader thread only
+    ArenaVector<float> interleaved;
+    ArenaVector<float> read_left;
+    ArenaVector<float> read_right;
+
+    // frames read ahead of consumer
+    FrameQueue frames;
+
+    std::unique_ptr<std::thread> reader_thread;
+
+    // thread will try to quit when true
+    std::atomic<bool> quit;
+    // frames were popped already, missing first frames is no underrun
+    bool consumed;
+
+    // gain of each file channel to left and right outputs
+    ArenaVector<float> gains_left;
+    ArenaVector<float> gains_right;
+
     std::atomic<bool> auto_rewind;
+
+    // decoded range and current read position, in frames
+    uint64_t start_frame;
+    uint64_t end_frame;
+    uint64_t position;
 };
 
 #endif//_WAVDECODER_HPP